@@ -0,0 +1,284 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "accounting.h"
+
+/*
+ * A PID in the accounting buffer of a GPU. The driver keeps an entry per
+ * process, so a reused PID is listed more than once. An entry gets dropped
+ * as soon as the driver dropped the PID from its (circular) buffer, so the
+ * table never grows beyond the size of all accounting buffers.
+ */
+typedef struct acct_st {
+	gpu_t	*gpu;
+	uint	pid;
+	uint	occurs;		//!< number of entries in the accounting buffer
+	uint	gen;		//!< last scrape the PID was listed
+	bool	done;		//!< completed and reported
+} acct_t;
+
+// a process completed since the last scrape
+typedef struct done_st {
+	gpu_t	*gpu;
+	uint	pid;
+	nvmlAccountingStats_t	stats;
+} done_t;
+
+static struct {
+	acct_t	*e;
+	uint	count;
+	uint	max;
+	uint	*pids;
+	uint	maxpids;
+	done_t	*done;
+	uint	ndone;
+	uint	maxdone;
+	uint	gen;
+} ac = { .e = NULL, .pids = NULL, .done = NULL };
+
+void
+freeAccounting(void) {
+	free(ac.e);
+	free(ac.pids);
+	free(ac.done);
+	memset(&ac, 0, sizeof(ac));
+}
+
+static acct_t *
+lookup(gpu_t *gpu, uint pid) {
+	acct_t *a;
+	uint i;
+
+	for (i = 0; i < ac.count; i++) {
+		if (ac.e[i].gpu == gpu && ac.e[i].pid == pid)
+			return &(ac.e[i]);
+	}
+	if (ac.count == ac.max) {
+		a = realloc(ac.e, sizeof(acct_t) * (ac.max + 64));
+		if (a == NULL)
+			return NULL;
+		ac.e = a;
+		ac.max += 64;
+	}
+	a = &(ac.e[ac.count++]);
+	memset(a, 0, sizeof(acct_t));
+	a->gpu = gpu;
+	a->pid = pid;
+	return a;
+}
+
+// return value of listPids(), if the PIDs could not be read this time
+#define PIDS_UNKNOWN -2
+
+/*
+ * The PIDs in the accounting buffer of the given GPU, -1 if n/a, or
+ * PIDS_UNKNOWN on transient errors and while accounting mode is disabled.
+ */
+static int
+listPids(gpu_t *gpu) {
+	nvmlReturn_t res;
+	nvmlEnableState_t mode;
+	uint *p, n = 0;
+
+	res = nvmlDeviceGetAccountingMode(gpu->dev, &mode);
+	if (NOT_AVAIL(res))
+		return -1;
+	// may get enabled anytime
+	if (NVML_SUCCESS != res || mode != NVML_FEATURE_ENABLED)
+		return PIDS_UNKNOWN;
+	res = nvmlDeviceGetAccountingPids(gpu->dev, &n, NULL);
+	if (NVML_ERROR_INSUFFICIENT_SIZE != res && NVML_SUCCESS != res)
+		return NOT_AVAIL(res) ? -1 : PIDS_UNKNOWN;
+	if (n == 0)
+		return 0;
+	if (n > ac.maxpids) {
+		p = realloc(ac.pids, sizeof(uint) * n);
+		if (p == NULL)
+			return PIDS_UNKNOWN;
+		ac.pids = p;
+		ac.maxpids = n;
+	}
+	res = nvmlDeviceGetAccountingPids(gpu->dev, &n, ac.pids);
+	return NVML_SUCCESS == res ? (int) n : PIDS_UNKNOWN;
+}
+
+static int
+cmppid(const void *a, const void *b) {
+	uint x = *((const uint *) a), y = *((const uint *) b);
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Query the stats of new PIDs and PIDs not yet completed, only. Completed
+ * ones get reported once.
+ */
+static void
+scan(gpu_t *gpu) {
+	nvmlReturn_t res;
+	nvmlAccountingStats_t stats;
+	acct_t *a;
+	done_t *d;
+	int n;
+	uint i, k;
+
+	n = listPids(gpu);
+	if (n == PIDS_UNKNOWN) {
+		// keep what is known, otherwise all get reported again
+		for (i = 0; i < ac.count; i++) {
+			if (ac.e[i].gpu == gpu)
+				ac.e[i].gen = ac.gen;
+		}
+		return;
+	}
+	if (n < 0) {
+		PROM_DEBUG("gpu.hasAccounting = -1", "");
+		gpu->hasAccounting = -1;
+		return;
+	}
+	gpu->hasAccounting = 1;
+	qsort(ac.pids, n, sizeof(uint), cmppid);
+	for (i = 0; i < (uint) n; i = k) {
+		for (k = i + 1; k < (uint) n && ac.pids[k] == ac.pids[i]; k++)
+			;
+		a = lookup(gpu, ac.pids[i]);
+		if (a == NULL)
+			continue;
+		a->gen = ac.gen;
+		if (a->done && a->occurs == k - i)
+			continue;
+		// a new process reused the PID (fewer: an old one got dropped)
+		if (k - i > a->occurs)
+			a->done = false;
+		a->occurs = k - i;
+		// the stats of the most recent process with this PID
+		res = nvmlDeviceGetAccountingStats(gpu->dev, a->pid, &stats);
+		if (NVML_SUCCESS != res) {
+			PROM_DEBUG("GPU %u: no accounting stats for PID %u: %s",
+				gpu->idx, a->pid, nverror(res));
+			continue;
+		}
+		if (stats.isRunning)
+			continue;
+		if (ac.ndone == ac.maxdone) {
+			d = realloc(ac.done, sizeof(done_t) * (ac.maxdone + 16));
+			if (d == NULL)
+				continue;
+			ac.done = d;
+			ac.maxdone += 16;
+		}
+		d = &(ac.done[ac.ndone++]);
+		d->gpu = gpu;
+		d->pid = a->pid;
+		d->stats = stats;
+		a->done = true;
+		gpu->acctCompleted++;
+	}
+}
+
+// drop PIDs the driver does not list anymore
+static void
+expire(void) {
+	uint i;
+
+	for (i = 0; i < ac.count; ) {
+		if (ac.e[i].gen != ac.gen)
+			ac.e[i] = ac.e[--ac.count];
+		else
+			i++;
+	}
+}
+
+bool
+getAccounting(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	done_t *d;
+	size_t sz;
+	uint i;
+	char buf[MBUF_SZ];
+	bool free_sb = sb == NULL, info = false;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getAccounting", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	ac.gen++;
+	ac.ndone = 0;
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev != NULL && gpu->hasAccounting != -1)
+			scan(gpu);
+	}
+	expire();
+
+	if (ac.ndone > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_ACCT_UTIL);
+		for (i = 0; i < ac.ndone; i++) {
+			d = &(ac.done[i]);
+			snprintf(buf, sizeof(buf), NVMEXM_ACCT_UTIL_N
+				"{gpu=\"%d\",pid=\"%u\",value=\"gpu\",uuid=\"%s\"} %u\n",
+				d->gpu->idx, d->pid, d->gpu->uuid, d->stats.gpuUtilization);
+			psb_add_str(sb, buf);
+			snprintf(buf, sizeof(buf), NVMEXM_ACCT_UTIL_N
+				"{gpu=\"%d\",pid=\"%u\",value=\"memory\",uuid=\"%s\"} %u\n",
+				d->gpu->idx, d->pid, d->gpu->uuid, d->stats.memoryUtilization);
+			psb_add_str(sb, buf);
+		}
+		if (!compact)
+			addPromInfo(NVMEXM_ACCT_MEM);
+		for (i = 0; i < ac.ndone; i++) {
+			d = &(ac.done[i]);
+			snprintf(buf, sizeof(buf), NVMEXM_ACCT_MEM_N
+				"{gpu=\"%d\",pid=\"%u\",uuid=\"%s\"} %llu\n",
+				d->gpu->idx, d->pid, d->gpu->uuid, d->stats.maxMemoryUsage);
+			psb_add_str(sb, buf);
+		}
+		if (!compact)
+			addPromInfo(NVMEXM_ACCT_TIME);
+		for (i = 0; i < ac.ndone; i++) {
+			d = &(ac.done[i]);
+			snprintf(buf, sizeof(buf), NVMEXM_ACCT_TIME_N
+				"{gpu=\"%d\",pid=\"%u\",uuid=\"%s\"} %llu\n",
+				d->gpu->idx, d->pid, d->gpu->uuid, d->stats.time);
+			psb_add_str(sb, buf);
+		}
+	}
+
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->hasAccounting != 1)
+			continue;
+		if (!compact && !info) {
+			addPromInfo(NVMEXM_ACCT_DONE);
+			info = true;
+		}
+		snprintf(buf, sizeof(buf), NVMEXM_ACCT_DONE_N
+			"{gpu=\"%d\",uuid=\"%s\"} %llu\n",
+			gpu->idx, gpu->uuid, gpu->acctCompleted);
+		psb_add_str(sb, buf);
+	}
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
@@ -41,9 +41,9 @@ getBar1memory(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 				NVMEXM_BAR1MEM_N "{gpu=\"%d\",sz=\"free\",uuid=\"%s\"} %lld\n"
 				NVMEXM_BAR1MEM_N "{gpu=\"%d\",sz=\"total\",uuid=\"%s\"} %lld\n"
 				NVMEXM_BAR1MEM_N "{gpu=\"%d\",sz=\"used\",uuid=\"%s\"} %lld\n",
-				i, gpu.uuid, mem.bar1Free,
-				i, gpu.uuid, mem.bar1Total,
-				i, gpu.uuid, mem.bar1Used);
+				gpu.idx, gpu.uuid, mem.bar1Free,
+				gpu.idx, gpu.uuid, mem.bar1Total,
+				gpu.idx, gpu.uuid, mem.bar1Used);
 			psb_add_str(sb, buf);
 			gpu.hasBar1memory = 1;
 		} else if (NOT_AVAIL(res)) {
@@ -217,6 +217,30 @@ setStaticClockVals(gpu_t *gpu, bool compact) {
 	}
 }
 
+bool
+getClocksStatic(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	uint i, k;
+	size_t sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_CLOCK);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL)
+			continue;
+		if (gpu->minMaxClock == NULL || gpu->defaultClock == NULL)
+			setStaticClockVals(gpu, compact);
+		if (gpu->defaultClock == NULL)
+			continue;
+		for (k = 0; k < NVML_CLOCK_COUNT; k++) {
+			psb_add_str(sb, (gpu->defaultClock)[k]);
+			psb_add_str(sb, gpu->minMaxClock[k]);
+		}
+	}
+	return psb_len(sb) != sz;
+}
+
 bool
 getClocks(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	nvmlReturn_t res;
@@ -241,17 +265,22 @@ getClocks(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		gpu = &(devList[i]);
 		if (gpu->dev == NULL)
 			continue;
-		if (gpu->minMaxClock == NULL || gpu->defaultClock == NULL)
+		if (!skipStatic
+			&& (gpu->minMaxClock == NULL || gpu->defaultClock == NULL))
+		{
 			setStaticClockVals(gpu, compact);
+		}
 		for (k = 0; k < NVML_CLOCK_COUNT; k++) {
-			psb_add_str(sb, (gpu->defaultClock)[k]);
-			psb_add_str(sb, gpu->minMaxClock[k]);
+			if (!skipStatic && gpu->defaultClock != NULL) {
+				psb_add_str(sb, (gpu->defaultClock)[k]);
+				psb_add_str(sb, gpu->minMaxClock[k]);
+			}
 			// current clock speed for the device. Fermi+
 			res = nvmlDeviceGetClockInfo(gpu->dev, k, &clockMHz);
 			if (NVML_SUCCESS == res) {
 				snprintf(buf, MBUF_SZ, NVMEXM_CLOCK_N
 				"{gpu=\"%d\",domain=\"%s\",clock=\"now\",uuid=\"%s\"} %u\n",
-				i, domain[k], gpu->uuid, clockMHz);
+				gpu->idx, domain[k], gpu->uuid, clockMHz);
 				psb_add_str(sb, buf);
 			}
 			// value to use unless an overspec situation. Kepler+
@@ -259,7 +288,7 @@ getClocks(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			if (NVML_SUCCESS == res) {
 				snprintf(buf, MBUF_SZ, NVMEXM_CLOCK_N
 				"{gpu=\"%d\",domain=\"%s\",clock=\"set\",uuid=\"%s\"} %u\n",
-				i, domain[k], gpu->uuid, clockMHz);
+				gpu->idx, domain[k], gpu->uuid, clockMHz);
 				psb_add_str(sb, buf);
 			}
 		}
@@ -275,7 +304,7 @@ getClocks(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		if (NVML_SUCCESS == res) {
 			snprintf(buf, MBUF_SZ,
 				NVMEXM_CLOCK_THROTTLE_N "{gpu=\"%d\",uuid=\"%s\"} %lld\n",
-				i, gpu->uuid, reasons);
+				gpu->idx, gpu->uuid, reasons);
 			psb_add_str(sb, buf);
 			gpu->hasClockThrottle = 1;
 		} else if (NOT_AVAIL(res)) {
@@ -33,13 +33,25 @@
 extern "C" {
 #endif
 
+/**
+ * A MIG device, i.e. a compute instance of a GPU instance of a GPU.
+ */
+typedef struct mig_st {
+	nvmlDevice_t	dev;	//!< device handle for the MIG device
+	char	*uuid;			//!< UUID of the MIG device, e.g. MIG-...
+	uint	idx;			//!< MIG device index within the GPU
+	uint	gi;				//!< GPU instance ID
+	uint	ci;				//!< compute instance ID
+} mig_t;
+
 /**
  * GPU data, we need to collect once, only.
  */
 typedef struct gpu_st {
 	nvmlDevice_t	dev;	//!< device handle for the GPU
 	char	*uuid;			//!< UUID of the GPU - survives reboot.
-	char	*pciId;	//!< PCI BUS ID - survives reboot if slot does not change.
+	char	*pciId;	//!< PCI BUS ID in kernel notation, e.g. 0000:3b:00.0 -
+					//!< survives reboot if slot does not change.
 	char	*info;
 	char	**minMaxClock;	//<! PROM metrics for minMax Clocks 
 	char	**defaultClock;	//<! PROM metrics for default Clock
@@ -48,8 +60,20 @@ typedef struct gpu_st {
 	char	*pcieLinkInfo;	//<! static PCIe infos
 	char	*nvLinkBW;		//<! static NvLinkBandwith
 	char	*nvLinkCount;	//<! static number of NvLinks
+	struct rline_st	*rcache;	//!< rendered lines, see rcache.h
+	struct pcifd_st	*pcifd;		//!< open sysfs files, see pcihealth.c
+	struct usamples_st	*usamples;	//!< driver sample state, see util.c
+	struct energy_st	*energy;	//!< energy integration state, see power.c
+	struct ecc_st	*ecc;	//!< incremental ECC state, see ecc.c
+	struct rate_st	*rates;	//!< counter rate state, see rate.c
+	mig_t	*mig;			//!< MIG devices of the GPU, see mig.c
+	struct vgpus_st	*vgpus;	//!< vGPU instance cache, see vgpu.c
+	struct dcgm_st	*dcgm;	//!< field value buffers, see dcgm.c
+	uint	migs;			//!< number of entries in mig
 	uint	idx;			//!< NVML index of the GPU. May change on reboot.
 	int		hasViolation;	//!< Bitmask about supported violation durations
+	unsigned long long	events;	//!< NVML event types registered for the GPU
+	unsigned long long	procUtilTs;	//!< timestamp of the last process sample
 	char	hasClockThrottle;
 	char	hasBar1memory;
 	char	hasTemperature;
@@ -63,16 +87,32 @@ typedef struct gpu_st {
 	char	hasDecoderUtil;
 	char	hasPCIeUtil;
 	char	hasPCIeReplay;
+	char	hasPCIeCount;
+	char	hasPCIeHealth;
 	char	hasECC;
 	char	hasRetiredPages;
 	char	hasRemappedRows;
 	char	hasNvLinks;
 	char	nvLinkFieldError;
 	char	nvLinks;		// sum up this number of nvLinks wrt. tx & rx
+	uint	nvLinkMask;		//!< active NVLinks, see nvlink.c
+	short	nvLinkPeer[NVML_NVLINK_MAX_LINKS];	//!< NVML index of the GPU at
+					//!< the other end of each link, see topo.c
+	unsigned long long	nvLinkBytes[NVML_NVLINK_MAX_LINKS][2];	//!< last tx
+					//!< and rx bytes read per link, see nvlink.c
+	uint	nvLinkBytesMask;	//!< links with valid nvLinkBytes
 #ifndef NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX
 	char	nvLinkSkipTxRx[NVML_NVLINK_MAX_LINKS + 1];
 	char	nvLinkTxRxError;
 #endif
+	char	hasProcs;
+	char	hasProcUtil;
+	char	hasAccounting;
+	unsigned long long	acctCompleted;	//!< see accounting.c
+	char	hasMig;
+	char	hasVgpu;
+	char	hasGpm;
+	char	hasDcgm;
 	char	hasEncStats;
 	char	hasEncSessions;
 	char	hasFbcStats;
@@ -81,6 +121,18 @@ typedef struct gpu_st {
 
 #define MBUF_SZ 256
 
+/** \c gpu_t.nvLinkPeer value for a link to something else than a GPU. */
+#define NVLINK_PEER_OTHER -1
+/** \c gpu_t.nvLinkPeer value for an inactive or unresolvable link. */
+#define NVLINK_PEER_UNKNOWN -2
+
+/**
+ * If \c true , collectors omit static metrics like limits, thresholds or
+ * link infos (which get probed once and cached in \c gpu_t ). These are still
+ * served via \c modStatic() .
+ */
+extern bool skipStatic;
+
 #define addPromInfo(metric) {\
 	psb_add_char(sb, '\n');\
 	psb_add_str(sb, "# HELP " metric ## _N " " metric ## _D );\
@@ -124,6 +176,82 @@ typedef struct gpu_st {
 #define NVMEXM_POWER_T "gauge"
 #define NVMEXM_POWER_N "nvmex_power_mW"
 
+#define NVMEXM_CGROUP_MEM_D "GPU memory used by the processes of a cgroup in bytes."
+#define NVMEXM_CGROUP_MEM_T "gauge"
+#define NVMEXM_CGROUP_MEM_N "nvmex_cgroup_memory_bytes"
+
+#define NVMEXM_CGROUP_TIME_D "Time a cgroup had at least one process on the GPU in seconds."
+#define NVMEXM_CGROUP_TIME_T "counter"
+#define NVMEXM_CGROUP_TIME_N "nvmex_cgroup_gpu_seconds_total"
+
+#define NVMEXM_PROC_UTIL_D "Mean utilization of a GPU engine by a process since the last scrape in percent."
+#define NVMEXM_PROC_UTIL_T "gauge"
+#define NVMEXM_PROC_UTIL_N "nvmex_gpu_process_util_pct"
+
+#define NVMEXM_ACCT_UTIL_D "Mean GPU and memory utilization of a process completed since the last scrape in percent."
+#define NVMEXM_ACCT_UTIL_T "gauge"
+#define NVMEXM_ACCT_UTIL_N "nvmex_accounting_util_pct"
+
+#define NVMEXM_ACCT_MEM_D "Max. GPU memory used by a process completed since the last scrape in bytes."
+#define NVMEXM_ACCT_MEM_T "gauge"
+#define NVMEXM_ACCT_MEM_N "nvmex_accounting_memory_max_bytes"
+
+#define NVMEXM_ACCT_TIME_D "Time a process completed since the last scrape ran on the GPU in milliseconds."
+#define NVMEXM_ACCT_TIME_T "gauge"
+#define NVMEXM_ACCT_TIME_N "nvmex_accounting_runtime_ms"
+
+#define NVMEXM_ACCT_DONE_D "Number of completed processes of a GPU reported so far."
+#define NVMEXM_ACCT_DONE_T "counter"
+#define NVMEXM_ACCT_DONE_N "nvmex_accounting_processes_total"
+
+#define NVMEXM_MIG_INFO_D "MIG devices of a GPU (gi .. GPU instance ID, ci .. compute instance ID)."
+#define NVMEXM_MIG_INFO_T "gauge"
+#define NVMEXM_MIG_INFO_N "nvmex_mig_info"
+
+#define NVMEXM_MIG_MEM_D "Memory of a MIG device in bytes."
+#define NVMEXM_MIG_MEM_T "gauge"
+#define NVMEXM_MIG_MEM_N "nvmex_mig_memory_bytes"
+
+#define NVMEXM_MIG_PROCS_D "Number of compute processes running on a MIG device."
+#define NVMEXM_MIG_PROCS_T "gauge"
+#define NVMEXM_MIG_PROCS_N "nvmex_mig_processes"
+
+#define NVMEXM_VGPU_INFO_D "Active vGPU instances of a GPU."
+#define NVMEXM_VGPU_INFO_T "gauge"
+#define NVMEXM_VGPU_INFO_N "nvmex_vgpu_info"
+
+#define NVMEXM_VGPU_FB_D "Framebuffer of a vGPU instance in bytes."
+#define NVMEXM_VGPU_FB_T "gauge"
+#define NVMEXM_VGPU_FB_N "nvmex_vgpu_fb_bytes"
+
+#define NVMEXM_VGPU_UTIL_D "Mean utilization of a GPU engine by a vGPU instance since the last scrape with new samples in percent."
+#define NVMEXM_VGPU_UTIL_T "gauge"
+#define NVMEXM_VGPU_UTIL_N "nvmex_vgpu_util_pct"
+
+#define NVMEXM_GPM_UTIL_D "GPM based utilization of the last second in percent."
+#define NVMEXM_GPM_UTIL_T "gauge"
+#define NVMEXM_GPM_UTIL_N "nvmex_gpm_util_pct"
+
+#define NVMEXM_GPM_BW_D "GPM based bus bandwidth of the last second in MiB/s."
+#define NVMEXM_GPM_BW_T "gauge"
+#define NVMEXM_GPM_BW_N "nvmex_gpm_bandwidth_MiBps"
+
+#define NVMEXM_ENERGY_D "Energy consumed since the exporter got started in joules."
+#define NVMEXM_ENERGY_T "counter"
+#define NVMEXM_ENERGY_N "nvmex_energy_joules_total"
+
+#define NVMEXM_POWER_AVG_D "Average power usage since the previous scrape in milliwatts."
+#define NVMEXM_POWER_AVG_T "gauge"
+#define NVMEXM_POWER_AVG_N "nvmex_power_average_mW"
+
+#define NVMEXM_POWER_WINDOW_D "Power usage in milliwatts sampled in the background since the last scrape."
+#define NVMEXM_POWER_WINDOW_T "gauge"
+#define NVMEXM_POWER_WINDOW_N "nvmex_power_window_mW"
+
+#define NVMEXM_POWER_OVER_D "Number of power samples above the threshold."
+#define NVMEXM_POWER_OVER_T "counter"
+#define NVMEXM_POWER_OVER_N "nvmex_power_over_threshold_total"
+
 #define NVMEXM_PSTATE_D "Current performance state (0=max .. 15=min)."
 #define NVMEXM_PSTATE_T "gauge"
 #define NVMEXM_PSTATE_N "nvmex_perf_state"
@@ -136,22 +264,54 @@ typedef struct gpu_st {
 #define NVMEXM_UTIL_T "gauge"
 #define NVMEXM_UTIL_N "nvmex_util_pct"
 
+#define NVMEXM_UTIL_HIST_D "Utilization samples taken by the driver in percent."
+#define NVMEXM_UTIL_HIST_T "histogram"
+#define NVMEXM_UTIL_HIST_N "nvmex_util_samples_pct"
+
+#define NVMEXM_UTIL_ZERO_D "Time in seconds the utilization was 0 according to the samples taken by the driver."
+#define NVMEXM_UTIL_ZERO_T "counter"
+#define NVMEXM_UTIL_ZERO_N "nvmex_util_zero_seconds_total"
+
+#define NVMEXM_CLOCK_WINDOW_D "Clock speeds in MHz sampled by the driver since the last scrape."
+#define NVMEXM_CLOCK_WINDOW_T "gauge"
+#define NVMEXM_CLOCK_WINDOW_N "nvmex_clock_window_MHz"
+
 #define NVMEXM_PCIE_UTIL_D "PCIe utilization in bytes/s measured for 20 ms."
 #define NVMEXM_PCIE_UTIL_T "gauge"
 #define NVMEXM_PCIE_UTIL_N "nvmex_pcie_util_Bps"
 
+#define NVMEXM_PCIE_BYTES_D "Number of bytes transferred via PCIe."
+#define NVMEXM_PCIE_BYTES_T "counter"
+#define NVMEXM_PCIE_BYTES_N "nvmex_pcie_bytes_total"
+
 #define NVMEXM_PCIE_REPLAY_D "PCIe replay count."
 #define NVMEXM_PCIE_REPLAY_T "counter"
 #define NVMEXM_PCIE_REPLAY_N "nvmex_pcie_replay_total"
 
+#define NVMEXM_PCIE_REPLAY_RATE_D "PCIe replays per second since the previous collection."
+#define NVMEXM_PCIE_REPLAY_RATE_T "gauge"
+#define NVMEXM_PCIE_REPLAY_RATE_N "nvmex_pcie_replay_per_second"
+
 #define NVMEXM_PCIE_LINK_D "PCIe link information."
 #define NVMEXM_PCIE_LINK_T "counter"
 #define NVMEXM_PCIE_LINK_N "nvmex_pcie_link"
 
+#define NVMEXM_THROTTLE_SEC_D "Time a reason for GPU clock throttling was active, sampled in the background."
+#define NVMEXM_THROTTLE_SEC_T "counter"
+#define NVMEXM_THROTTLE_SEC_N "nvmex_throttle_seconds_total"
+
+#define NVMEXM_THROTTLE_ACTIVE_D "Whether a reason for GPU clock throttling is active (0 .. no, 1 .. yes) as seen by the last sample."
+#define NVMEXM_THROTTLE_ACTIVE_T "gauge"
+#define NVMEXM_THROTTLE_ACTIVE_N "nvmex_throttle_active"
+
 #define NVMEXM_VIOL_D "How long a policy caused the GPU to be below application or base clocks."
 #define NVMEXM_VIOL_T "counter"
 #define NVMEXM_VIOL_N "nvmex_violation_penalty_ms"
 
+#define NVMEXM_VIOL_RATE_D "Fraction of time a policy caused the GPU to be below application or base clocks since the previous collection (0 .. never, 1 .. always)."
+#define NVMEXM_VIOL_RATE_T "gauge"
+#define NVMEXM_VIOL_RATE_N "nvmex_violation_penalty_ratio"
+
 #define NVMEXM_MEM_D "Device memory in bytes."
 #define NVMEXM_MEM_T "gauge"
 #define NVMEXM_MEM_N "nvmex_memory_bytes"
@@ -168,6 +328,14 @@ typedef struct gpu_st {
 #define NVMEXM_ECC_PAGE_T "counter"
 #define NVMEXM_ECC_PAGE_N "nvmex_ecc_retired_pages"
 
+#define NVMEXM_ECC_SKIP_D "Number of NVML calls and field values not needed, because the ECC totals did not change."
+#define NVMEXM_ECC_SKIP_T "counter"
+#define NVMEXM_ECC_SKIP_N "nvmex_ecc_skipped_total"
+
+#define NVMEXM_ECC_EXTRA_D "Number of additional NVML calls needed to read the ECC counters per location, because a total changed."
+#define NVMEXM_ECC_EXTRA_T "counter"
+#define NVMEXM_ECC_EXTRA_N "nvmex_ecc_extra_calls_total"
+
 #define NVMEXM_ECC_ROW_D "Number of remapped rows ('pending','failure': 0 .. no, 1 .. yes)."
 #define NVMEXM_ECC_ROW_T "counter"
 #define NVMEXM_ECC_ROW_N "nvmex_ecc_remapped_rows"
@@ -176,6 +344,26 @@ typedef struct gpu_st {
 #define NVMEXM_NVLINK_ERR_T "counter"
 #define NVMEXM_NVLINK_ERR_N "nvmex_nvlink_errors"
 
+#define NVMEXM_TOPO_PATH_D "Closest common ancestor of two GPUs (0 .. same board, 10 .. single PCIe switch, 20 .. multiple PCIe switches, 30 .. host bridge, 40 .. NUMA node, 50 .. system)."
+#define NVMEXM_TOPO_PATH_T "gauge"
+#define NVMEXM_TOPO_PATH_N "nvmex_topology_path"
+
+#define NVMEXM_TOPO_NVLINK_D "Number of active NVLinks from a GPU to a peer GPU or something else (peer=other), e.g. a NVSwitch."
+#define NVMEXM_TOPO_NVLINK_T "gauge"
+#define NVMEXM_TOPO_NVLINK_N "nvmex_topology_nvlinks"
+
+#define NVMEXM_TOPO_CPU_D "CPUs with the best affinity to a GPU."
+#define NVMEXM_TOPO_CPU_T "gauge"
+#define NVMEXM_TOPO_CPU_N "nvmex_topology_cpu_affinity_info"
+
+#define NVMEXM_NVLINK_LERR_D "NVLink errors and retries per link."
+#define NVMEXM_NVLINK_LERR_T "counter"
+#define NVMEXM_NVLINK_LERR_N "nvmex_nvlink_link_errors"
+
+#define NVMEXM_NVLINK_PEER_D "NVLink traffic in bytes between a GPU and its peer (peer=other: not a GPU, e.g. a NVSwitch). value=tx is sent by the GPU to the peer."
+#define NVMEXM_NVLINK_PEER_T "counter"
+#define NVMEXM_NVLINK_PEER_N "nvmex_nvlink_peer_traffic_bytes"
+
 #define NVMEXM_NVLINK_BW_D "Common NVLink bandwidth in MB/s for active links."
 #define NVMEXM_NVLINK_BW_T "counter"
 #define NVMEXM_NVLINK_BW_N "nvmex_nvlink_bandwidth_MBps"
@@ -188,6 +376,10 @@ typedef struct gpu_st {
 #define NVMEXM_NVLINK_TRAFFIC_T "counter"
 #define NVMEXM_NVLINK_TRAFFIC_N "nvmex_nvlink_traffic_bytes"
 
+#define NVMEXM_NVLINK_TRAFFIC_RATE_D "NVLink traffic in bytes per second since the previous collection."
+#define NVMEXM_NVLINK_TRAFFIC_RATE_T "gauge"
+#define NVMEXM_NVLINK_TRAFFIC_RATE_N "nvmex_nvlink_traffic_bytes_per_second"
+
 #define NVMEXM_ENCSTAT_SESS_D "Number of active encoder sessions."
 #define NVMEXM_ENCSTAT_SESS_T "gauge"
 #define NVMEXM_ENCSTAT_SESS_N "nvmex_enc_stat_sessions"
@@ -228,6 +420,26 @@ typedef struct gpu_st {
 #define NVMEXM_FBCSESS_LAT_T "gauge"
 #define NVMEXM_FBCSESS_LAT_N "nvmex_fbc_session_latency_us"
 
+#define NVMEXM_PCIE_AER_D "PCIe AER errors reported by the kernel."
+#define NVMEXM_PCIE_AER_T "counter"
+#define NVMEXM_PCIE_AER_N "nvmex_pcie_aer_errors_total"
+
+#define NVMEXM_PCIE_SPEED_D "PCIe link speed in GT/s reported by the kernel."
+#define NVMEXM_PCIE_SPEED_T "gauge"
+#define NVMEXM_PCIE_SPEED_N "nvmex_pcie_link_speed_GTps"
+
+#define NVMEXM_PCIE_WIDTH_D "PCIe link width (lanes) reported by the kernel."
+#define NVMEXM_PCIE_WIDTH_T "gauge"
+#define NVMEXM_PCIE_WIDTH_N "nvmex_pcie_link_width"
+
+#define NVMEXM_XID_D "Number of Xid errors reported by the driver."
+#define NVMEXM_XID_T "counter"
+#define NVMEXM_XID_N "nvmex_xid_errors_total"
+
+#define NVMEXM_RCACHE_D "Number of metric lines reused from (hit) or rendered into (miss) the render cache."
+#define NVMEXM_RCACHE_T "counter"
+#define NVMEXM_RCACHE_N "nvmex_render_cache_lines_total"
+
 /*
 #define NVMEXM_XXX_D "short description."
 #define NVMEXM_XXX_T "gauge"
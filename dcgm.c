@@ -0,0 +1,634 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "dcgm.h"
+
+#define DCGM_PREFIX "DCGM_FI_"
+
+/*
+ * DCGM fields with an NVML field value counterpart. Fields DCGM computes
+ * from other NVML calls (clocks, temperature, utilization, ...) have none,
+ * see dmap[] for them.
+ */
+static const struct {
+	const char	*name;	//!< DCGM field name without DCGM_FI_
+	uint	id;			//!< NVML field ID
+	double	scale;		//!< NVML value * scale = DCGM value
+} fmap[] = {
+	{ "DEV_ECC_CURRENT", NVML_FI_DEV_ECC_CURRENT, 1 },
+	{ "DEV_ECC_PENDING", NVML_FI_DEV_ECC_PENDING, 1 },
+	{ "DEV_ECC_SBE_VOL_TOTAL", NVML_FI_DEV_ECC_SBE_VOL_TOTAL, 1 },
+	{ "DEV_ECC_DBE_VOL_TOTAL", NVML_FI_DEV_ECC_DBE_VOL_TOTAL, 1 },
+	{ "DEV_ECC_SBE_AGG_TOTAL", NVML_FI_DEV_ECC_SBE_AGG_TOTAL, 1 },
+	{ "DEV_ECC_DBE_AGG_TOTAL", NVML_FI_DEV_ECC_DBE_AGG_TOTAL, 1 },
+	{ "DEV_ECC_SBE_VOL_L1", NVML_FI_DEV_ECC_SBE_VOL_L1, 1 },
+	{ "DEV_ECC_DBE_VOL_L1", NVML_FI_DEV_ECC_DBE_VOL_L1, 1 },
+	{ "DEV_ECC_SBE_VOL_L2", NVML_FI_DEV_ECC_SBE_VOL_L2, 1 },
+	{ "DEV_ECC_DBE_VOL_L2", NVML_FI_DEV_ECC_DBE_VOL_L2, 1 },
+	{ "DEV_ECC_SBE_VOL_DEV", NVML_FI_DEV_ECC_SBE_VOL_DEV, 1 },
+	{ "DEV_ECC_DBE_VOL_DEV", NVML_FI_DEV_ECC_DBE_VOL_DEV, 1 },
+	{ "DEV_ECC_SBE_VOL_REG", NVML_FI_DEV_ECC_SBE_VOL_REG, 1 },
+	{ "DEV_ECC_DBE_VOL_REG", NVML_FI_DEV_ECC_DBE_VOL_REG, 1 },
+	{ "DEV_ECC_SBE_VOL_TEX", NVML_FI_DEV_ECC_SBE_VOL_TEX, 1 },
+	{ "DEV_ECC_DBE_VOL_TEX", NVML_FI_DEV_ECC_DBE_VOL_TEX, 1 },
+	{ "DEV_ECC_SBE_AGG_L1", NVML_FI_DEV_ECC_SBE_AGG_L1, 1 },
+	{ "DEV_ECC_DBE_AGG_L1", NVML_FI_DEV_ECC_DBE_AGG_L1, 1 },
+	{ "DEV_ECC_SBE_AGG_L2", NVML_FI_DEV_ECC_SBE_AGG_L2, 1 },
+	{ "DEV_ECC_DBE_AGG_L2", NVML_FI_DEV_ECC_DBE_AGG_L2, 1 },
+	{ "DEV_ECC_SBE_AGG_DEV", NVML_FI_DEV_ECC_SBE_AGG_DEV, 1 },
+	{ "DEV_ECC_DBE_AGG_DEV", NVML_FI_DEV_ECC_DBE_AGG_DEV, 1 },
+	{ "DEV_ECC_SBE_AGG_REG", NVML_FI_DEV_ECC_SBE_AGG_REG, 1 },
+	{ "DEV_ECC_DBE_AGG_REG", NVML_FI_DEV_ECC_DBE_AGG_REG, 1 },
+	{ "DEV_ECC_SBE_AGG_TEX", NVML_FI_DEV_ECC_SBE_AGG_TEX, 1 },
+	{ "DEV_ECC_DBE_AGG_TEX", NVML_FI_DEV_ECC_DBE_AGG_TEX, 1 },
+	{ "DEV_RETIRED_SBE", NVML_FI_DEV_RETIRED_SBE, 1 },
+	{ "DEV_RETIRED_DBE", NVML_FI_DEV_RETIRED_DBE, 1 },
+	{ "DEV_RETIRED_PENDING", NVML_FI_DEV_RETIRED_PENDING, 1 },
+	{ "DEV_NVLINK_CRC_FLIT_ERROR_COUNT_TOTAL",
+		NVML_FI_DEV_NVLINK_CRC_FLIT_ERROR_COUNT_TOTAL, 1 },
+	{ "DEV_NVLINK_CRC_DATA_ERROR_COUNT_TOTAL",
+		NVML_FI_DEV_NVLINK_CRC_DATA_ERROR_COUNT_TOTAL, 1 },
+	{ "DEV_NVLINK_REPLAY_ERROR_COUNT_TOTAL",
+		NVML_FI_DEV_NVLINK_REPLAY_ERROR_COUNT_TOTAL, 1 },
+	{ "DEV_NVLINK_RECOVERY_ERROR_COUNT_TOTAL",
+		NVML_FI_DEV_NVLINK_RECOVERY_ERROR_COUNT_TOTAL, 1 },
+#ifdef NVML_FI_DEV_MEMORY_TEMP
+	{ "DEV_MEMORY_TEMP", NVML_FI_DEV_MEMORY_TEMP, 1 },
+#endif
+#ifdef NVML_FI_DEV_TOTAL_ENERGY_CONSUMPTION
+	// mJ
+	{ "DEV_TOTAL_ENERGY_CONSUMPTION", NVML_FI_DEV_TOTAL_ENERGY_CONSUMPTION, 1},
+#endif
+#ifdef NVML_FI_DEV_PCIE_REPLAY_COUNTER
+	{ "DEV_PCIE_REPLAY_COUNTER", NVML_FI_DEV_PCIE_REPLAY_COUNTER, 1 },
+#endif
+#ifdef NVML_FI_DEV_PERF_POLICY_POWER
+	// ns -> us
+	{ "DEV_POWER_VIOLATION", NVML_FI_DEV_PERF_POLICY_POWER, 1e-3 },
+	{ "DEV_THERMAL_VIOLATION", NVML_FI_DEV_PERF_POLICY_THERMAL, 1e-3 },
+	{ "DEV_SYNC_BOOST_VIOLATION", NVML_FI_DEV_PERF_POLICY_SYNC_BOOST, 1e-3 },
+	{ "DEV_BOARD_LIMIT_VIOLATION", NVML_FI_DEV_PERF_POLICY_BOARD_LIMIT, 1e-3 },
+	{ "DEV_LOW_UTIL_VIOLATION", NVML_FI_DEV_PERF_POLICY_LOW_UTILIZATION,1e-3},
+	{ "DEV_RELIABILITY_VIOLATION", NVML_FI_DEV_PERF_POLICY_RELIABILITY, 1e-3 },
+	{ "DEV_TOTAL_APP_CLOCKS_VIOLATION",
+		NVML_FI_DEV_PERF_POLICY_TOTAL_APP_CLOCKS, 1e-3 },
+	{ "DEV_TOTAL_BASE_CLOCKS_VIOLATION",
+		NVML_FI_DEV_PERF_POLICY_TOTAL_BASE_CLOCKS, 1e-3 },
+#endif
+#ifdef NVML_FI_DEV_REMAPPED_COR
+	{ "DEV_CORRECTABLE_REMAPPED_ROWS", NVML_FI_DEV_REMAPPED_COR, 1 },
+	{ "DEV_UNCORRECTABLE_REMAPPED_ROWS", NVML_FI_DEV_REMAPPED_UNC, 1 },
+	{ "DEV_ROW_REMAP_FAILURE", NVML_FI_DEV_REMAPPED_FAILURE, 1 },
+#endif
+#ifdef NVML_FI_DEV_POWER_AVERAGE
+	// mW -> W
+	{ "DEV_POWER_USAGE", NVML_FI_DEV_POWER_AVERAGE, 1e-3 },
+#endif
+#ifdef NVML_FI_DEV_POWER_CURRENT_LIMIT
+	{ "DEV_POWER_MGMT_LIMIT", NVML_FI_DEV_POWER_REQUESTED_LIMIT, 1e-3 },
+	{ "DEV_POWER_MGMT_LIMIT_MIN", NVML_FI_DEV_POWER_MIN_LIMIT, 1e-3 },
+	{ "DEV_POWER_MGMT_LIMIT_MAX", NVML_FI_DEV_POWER_MAX_LIMIT, 1e-3 },
+	{ "DEV_POWER_MGMT_LIMIT_DEF", NVML_FI_DEV_POWER_DEFAULT_LIMIT, 1e-3 },
+	{ "DEV_ENFORCED_POWER_LIMIT", NVML_FI_DEV_POWER_CURRENT_LIMIT, 1e-3 },
+#endif
+};
+#define FMAP (sizeof(fmap)/sizeof(fmap[0]))
+
+/*
+ * The sources of the derived fields of a GPU for a single scrape. NVML calls
+ * serving more than one field get made once and their result gets shared.
+ */
+typedef struct dsrc_st {
+	nvmlDevice_t	dev;
+	bool	hasUtil;			//!< util and utilRes are set
+	nvmlReturn_t	utilRes;
+	nvmlUtilization_t	util;
+	bool	hasMem;				//!< mem and memRes are set
+	nvmlReturn_t	memRes;
+	nvmlMemory_t	mem;
+} dsrc_t;
+
+typedef nvmlReturn_t (*getter_t)(dsrc_t *src, uint arg, nvmlFieldValue_t *fv);
+
+static nvmlReturn_t
+getClock(dsrc_t *src, uint arg, nvmlFieldValue_t *fv) {
+	fv->valueType = NVML_VALUE_TYPE_UNSIGNED_INT;
+	return nvmlDeviceGetClockInfo(src->dev, arg, &(fv->value.uiVal));
+}
+
+static nvmlReturn_t
+getTemp(dsrc_t *src, uint arg, nvmlFieldValue_t *fv) {
+	fv->valueType = NVML_VALUE_TYPE_UNSIGNED_INT;
+	return nvmlDeviceGetTemperature(src->dev, arg, &(fv->value.uiVal));
+}
+
+// arg: 0 .. gpu, 1 .. memory, 2 .. encoder, 3 .. decoder
+static nvmlReturn_t
+getUtil(dsrc_t *src, uint arg, nvmlFieldValue_t *fv) {
+	uint period;
+
+	fv->valueType = NVML_VALUE_TYPE_UNSIGNED_INT;
+	if (arg == 2)
+		return nvmlDeviceGetEncoderUtilization(src->dev, &(fv->value.uiVal),
+			&period);
+	if (arg == 3)
+		return nvmlDeviceGetDecoderUtilization(src->dev, &(fv->value.uiVal),
+			&period);
+	if (!src->hasUtil) {
+		src->utilRes = nvmlDeviceGetUtilizationRates(src->dev, &(src->util));
+		src->hasUtil = true;
+	}
+	fv->value.uiVal = arg == 0 ? src->util.gpu : src->util.memory;
+	return src->utilRes;
+}
+
+// arg: 0 .. total, 1 .. free, 2 .. used
+static nvmlReturn_t
+getFB(dsrc_t *src, uint arg, nvmlFieldValue_t *fv) {
+	nvmlMemory_t *m = &(src->mem);
+
+	if (!src->hasMem) {
+		src->memRes = nvmlDeviceGetMemoryInfo(src->dev, m);
+		src->hasMem = true;
+	}
+	fv->valueType = NVML_VALUE_TYPE_UNSIGNED_LONG_LONG;
+	fv->value.ullVal = (arg == 0 ? m->total : (arg == 1 ? m->free : m->used))
+		>> 20;		// MiB
+	return src->memRes;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static nvmlReturn_t
+getPstate(dsrc_t *src, uint arg, nvmlFieldValue_t *fv) {
+	nvmlReturn_t res;
+	nvmlPstates_t ps;
+
+	res = nvmlDeviceGetPerformanceState(src->dev, &ps);
+	fv->valueType = NVML_VALUE_TYPE_UNSIGNED_INT;
+	fv->value.uiVal = ps;
+	return res;
+}
+
+static nvmlReturn_t
+getFan(dsrc_t *src, uint arg, nvmlFieldValue_t *fv) {
+	fv->valueType = NVML_VALUE_TYPE_UNSIGNED_INT;
+	return nvmlDeviceGetFanSpeed(src->dev, &(fv->value.uiVal));
+}
+
+#ifndef NVML_FI_DEV_POWER_AVERAGE
+static nvmlReturn_t
+getPower(dsrc_t *src, uint arg, nvmlFieldValue_t *fv) {
+	fv->valueType = NVML_VALUE_TYPE_UNSIGNED_INT;
+	return nvmlDeviceGetPowerUsage(src->dev, &(fv->value.uiVal));
+}
+#endif
+#pragma GCC diagnostic pop
+
+/*
+ * DCGM fields without an NVML field value counterpart, which can be
+ * derived from a single NVML call. Each source costs one call per GPU and
+ * scrape, no matter how many fields it serves.
+ */
+static const struct {
+	const char	*name;	//!< DCGM field name without DCGM_FI_
+	getter_t	get;
+	uint	arg;		//!< passed to get
+	double	scale;		//!< NVML value * scale = DCGM value
+} dmap[] = {
+	{ "DEV_SM_CLOCK", getClock, NVML_CLOCK_SM, 1 },
+	{ "DEV_MEM_CLOCK", getClock, NVML_CLOCK_MEM, 1 },
+	{ "DEV_VIDEO_CLOCK", getClock, NVML_CLOCK_VIDEO, 1 },
+	{ "DEV_GPU_TEMP", getTemp, NVML_TEMPERATURE_GPU, 1 },
+	{ "DEV_GPU_UTIL", getUtil, 0, 1 },
+	{ "DEV_MEM_COPY_UTIL", getUtil, 1, 1 },
+	{ "DEV_ENC_UTIL", getUtil, 2, 1 },
+	{ "DEV_DEC_UTIL", getUtil, 3, 1 },
+	{ "DEV_FB_TOTAL", getFB, 0, 1 },
+	{ "DEV_FB_FREE", getFB, 1, 1 },
+	{ "DEV_FB_USED", getFB, 2, 1 },
+	{ "DEV_PSTATE", getPstate, 0, 1 },
+	{ "DEV_FAN_SPEED", getFan, 0, 1 },
+#ifndef NVML_FI_DEV_POWER_AVERAGE
+	// mW -> W
+	{ "DEV_POWER_USAGE", getPower, 0, 1e-3 },
+#endif
+};
+#define DMAP (sizeof(dmap)/sizeof(dmap[0]))
+
+typedef struct field_st {
+	char	*name;		//!< prom metric name, i.e. DCGM_FI_*
+	char	*help;
+	bool	counter;	//!< prom type counter, gauge otherwise
+	uint	id;			//!< NVML field ID
+	getter_t	get;	//!< if not NULL, get the value this way instead
+	uint	arg;		//!< argument for get
+	double	scale;
+} field_t;
+
+static struct {
+	field_t	*f;
+	uint	count;
+} fields = { .f = NULL, .count = 0 };
+
+// per GPU state
+typedef struct dcgm_st {
+	char	*labels;			//!< rendered dcgm-exporter label set
+	nvmlFieldValue_t	*fv;	//!< request/response of the supported fields
+	nvmlFieldValue_t	*dv;	//!< values of the derived fields per field
+	int		*slot;				//!< index into fv per field, -1 if unsupported
+								//!< or derived
+	uint	n;					//!< number of entries in fv
+	bool	probed;				//!< unsupported fields got dropped
+} dcgm_t;
+
+static void
+freeFields(void) {
+	uint i;
+
+	for (i = 0; i < fields.count; i++) {
+		free(fields.f[i].name);
+		free(fields.f[i].help);
+	}
+	free(fields.f);
+	fields.f = NULL;
+	fields.count = 0;
+}
+
+static char *
+trim(char *s) {
+	char *e;
+
+	while (isspace((unsigned char) *s))
+		s++;
+	e = s + strlen(s);
+	while (e > s && isspace((unsigned char) e[-1]))
+		e--;
+	*e = '\0';
+	return s;
+}
+
+// split off the next comma separated column of *s
+static char *
+column(char **s) {
+	char *c = *s, *e;
+
+	if (c == NULL)
+		return NULL;
+	e = strchr(c, ',');
+	if (e == NULL) {
+		*s = NULL;
+	} else {
+		*e = '\0';
+		*s = e + 1;
+	}
+	return trim(c);
+}
+
+static int
+addField(const char *file, uint line, char *name, char *type, char *help) {
+	field_t *f;
+	char *s;
+	uint i, k, j;
+
+	if (strncmp(name, DCGM_PREFIX, sizeof(DCGM_PREFIX) - 1) == 0)
+		name += sizeof(DCGM_PREFIX) - 1;
+	if (strcmp(type, "gauge") != 0 && strcmp(type, "counter") != 0) {
+		PROM_WARN("%s:%u: invalid metric type '%s' - skipped",
+			file, line, type);
+		return 0;
+	}
+	for (k = 0; k < FMAP && strcmp(fmap[k].name, name) != 0; k++)
+		;
+	for (j = 0; k == FMAP && j < DMAP; j++) {
+		if (strcmp(dmap[j].name, name) == 0)
+			break;
+	}
+	if (k == FMAP && j == DMAP) {
+		PROM_INFO("%s:%u: no NVML field for " DCGM_PREFIX "%s - skipped",
+			file, line, name);
+		return 0;
+	}
+	for (i = 0; i < fields.count; i++) {
+		if (strcmp(fields.f[i].name + sizeof(DCGM_PREFIX) - 1, name) == 0) {
+			PROM_INFO("%s:%u: duplicate field " DCGM_PREFIX "%s - skipped",
+				file, line, name);
+			return 0;
+		}
+	}
+	f = realloc(fields.f, sizeof(field_t) * (fields.count + 1));
+	if (f == NULL)
+		return 1;
+	fields.f = f;
+	f = &(fields.f[fields.count]);
+	f->name = malloc(sizeof(DCGM_PREFIX) + strlen(name));
+	if (f->name == NULL)
+		return 1;
+	sprintf(f->name, DCGM_PREFIX "%s", name);
+	// the help text ends up in a comment line
+	for (s = help; *s != '\0'; s++) {
+		if (*s == '\\')
+			*s = '/';
+	}
+	f->help = strdup(help);
+	f->counter = type[0] == 'c';
+	if (k < FMAP) {
+		f->id = fmap[k].id;
+		f->get = NULL;
+		f->arg = 0;
+		f->scale = fmap[k].scale;
+	} else {
+		f->id = 0;
+		f->get = dmap[j].get;
+		f->arg = dmap[j].arg;
+		f->scale = dmap[j].scale;
+	}
+	fields.count++;
+	return 0;
+}
+
+int
+setFieldsFile(const char *file) {
+	FILE *fp;
+	char buf[1024], *s, *name, *type;
+	uint line = 0;
+	int err = 0;
+
+	freeFields();
+	if (file == NULL)
+		return 0;
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		PROM_WARN("Unable to open field file '%s': %s", file, strerror(errno));
+		return 1;
+	}
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		line++;
+		s = trim(buf);
+		if (*s == '\0' || *s == '#')
+			continue;
+		name = column(&s);
+		// optional numeric DCGM field ID
+		if (isdigit((unsigned char) *name))
+			name = column(&s);
+		type = column(&s);
+		if (name == NULL || type == NULL || s == NULL) {
+			PROM_WARN("%s:%u: invalid line - skipped", file, line);
+			continue;
+		}
+		if (*name == '#')
+			continue;			// disabled
+		err += addField(file, line, name, type, trim(s));
+	}
+	fclose(fp);
+	PROM_INFO("%u fields loaded from '%s'", fields.count, file);
+	if (err)
+		freeFields();
+	return err ? 1 : 0;
+}
+
+void
+freeDcgm(gpu_t *gpu) {
+	if (gpu->dcgm == NULL)
+		return;
+	free(gpu->dcgm->labels);
+	free(gpu->dcgm->fv);
+	free(gpu->dcgm->dv);
+	free(gpu->dcgm->slot);
+	free(gpu->dcgm);
+	gpu->dcgm = NULL;
+}
+
+static dcgm_t *
+setup(gpu_t *gpu, const char *host) {
+	dcgm_t *d;
+	char name[NVML_DEVICE_NAME_BUFFER_SIZE], buf[MBUF_SZ];
+	uint i, minor;
+
+	d = calloc(1, sizeof(dcgm_t));
+	if (d == NULL)
+		return NULL;
+	d->fv = calloc(fields.count, sizeof(nvmlFieldValue_t));
+	d->dv = calloc(fields.count, sizeof(nvmlFieldValue_t));
+	d->slot = malloc(sizeof(int) * fields.count);
+	if (d->fv == NULL || d->dv == NULL || d->slot == NULL) {
+		free(d->fv);
+		free(d->dv);
+		free(d->slot);
+		free(d);
+		return NULL;
+	}
+	for (i = 0; i < fields.count; i++) {
+		if (fields.f[i].get != NULL) {
+			d->slot[i] = -1;
+			continue;
+		}
+		d->fv[d->n].fieldId = fields.f[i].id;
+		d->slot[i] = d->n++;
+	}
+	if (nvmlDeviceGetName(gpu->dev, name, sizeof(name)) != NVML_SUCCESS)
+		name[0] = '\0';
+	if (nvmlDeviceGetMinorNumber(gpu->dev, &minor) != NVML_SUCCESS)
+		minor = gpu->idx;
+	snprintf(buf, sizeof(buf), "{gpu=\"%d\",UUID=\"GPU-%s\",device=\"nvidia%u\","
+		"modelName=\"%s\",Hostname=\"%s\"}", gpu->idx, gpu->uuid, minor,
+		name, host);
+	d->labels = strdup(buf);
+	gpu->dcgm = d;
+	return d;
+}
+
+// drop the fields the GPU does not support, so they do not get asked again
+static void
+probe(gpu_t *gpu, dcgm_t *d) {
+	uint i, k = 0, m = 0;
+
+	for (i = 0; i < fields.count; i++) {
+		if (fields.f[i].get != NULL) {
+			if (NOT_AVAIL(d->dv[i].nvmlReturn))
+				PROM_DEBUG("GPU %u: %s not supported", gpu->idx,
+					fields.f[i].name);
+			else
+				m++;
+			continue;
+		}
+		if (d->slot[i] < 0)
+			continue;
+		if (NOT_AVAIL(d->fv[d->slot[i]].nvmlReturn)) {
+			PROM_DEBUG("GPU %u: %s not supported", gpu->idx, fields.f[i].name);
+			d->slot[i] = -1;
+			continue;
+		}
+		d->fv[k] = d->fv[d->slot[i]];
+		d->slot[i] = k++;
+	}
+	d->n = k;
+	d->probed = true;
+	if (k == 0 && m == 0) {
+		PROM_DEBUG("gpu.hasDcgm = -1", "");
+		gpu->hasDcgm = -1;
+	}
+}
+
+static void
+render(char *buf, size_t len, const char *name, const char *labels,
+	nvmlFieldValue_t *fv, double scale)
+{
+	double d;
+
+	switch (fv->valueType) {
+		case NVML_VALUE_TYPE_DOUBLE:
+			d = fv->value.dVal;
+			break;
+		case NVML_VALUE_TYPE_UNSIGNED_LONG:
+			d = fv->value.ulVal;
+			if (scale == 1) {
+				snprintf(buf, len, "%s%s %lu\n", name, labels, fv->value.ulVal);
+				return;
+			}
+			break;
+		case NVML_VALUE_TYPE_UNSIGNED_LONG_LONG:
+			d = fv->value.ullVal;
+			if (scale == 1) {
+				snprintf(buf, len, "%s%s %llu\n", name, labels,fv->value.ullVal);
+				return;
+			}
+			break;
+		case NVML_VALUE_TYPE_SIGNED_LONG_LONG:
+			d = fv->value.sllVal;
+			if (scale == 1) {
+				snprintf(buf, len, "%s%s %lld\n", name, labels,fv->value.sllVal);
+				return;
+			}
+			break;
+		case NVML_VALUE_TYPE_SIGNED_INT:
+			d = fv->value.siVal;
+			if (scale == 1) {
+				snprintf(buf, len, "%s%s %d\n", name, labels, fv->value.siVal);
+				return;
+			}
+			break;
+		default:
+			d = fv->value.uiVal;
+			if (scale == 1) {
+				snprintf(buf, len, "%s%s %u\n", name, labels, fv->value.uiVal);
+				return;
+			}
+	}
+	snprintf(buf, len, "%s%s %.3f\n", name, labels, d * scale);
+}
+
+bool
+getDcgm(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	nvmlReturn_t res;
+	gpu_t *gpu;
+	dcgm_t *d;
+	size_t sz;
+	uint i, k;
+	int n;
+	char buf[MBUF_SZ], host[256];
+	bool free_sb = sb == NULL;
+	psb_t *sbv;
+	nvmlFieldValue_t *fv;
+	dsrc_t src;
+
+	if (devs == 0 || fields.count == 0)
+		return false;
+
+	PROM_DEBUG("getDcgm", "");
+	sbv = psb_new();
+	if (sbv == NULL)
+		return false;
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	if (gethostname(host, sizeof(host)) != 0)
+		host[0] = '\0';
+	host[sizeof(host) - 1] = '\0';
+	// one call per GPU
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasDcgm == -1)
+			continue;
+		d = gpu->dcgm == NULL ? setup(gpu, host) : gpu->dcgm;
+		if (d == NULL)
+			continue;
+		memset(&src, 0, sizeof(src));
+		src.dev = gpu->dev;
+		for (k = 0; k < fields.count; k++) {
+			if (fields.f[k].get == NULL
+				|| (d->probed && NOT_AVAIL(d->dv[k].nvmlReturn)))
+			{
+				continue;
+			}
+			d->dv[k].nvmlReturn = fields.f[k].get(&src, fields.f[k].arg,
+				&(d->dv[k]));
+		}
+		res = d->n == 0
+			? NVML_SUCCESS : nvmlDeviceGetFieldValues(gpu->dev, d->n, d->fv);
+		if (NVML_SUCCESS != res) {
+			PROM_DEBUG("GPU %u: field values failed: %s", gpu->idx,
+				nverror(res));
+			for (k = 0; k < d->n; k++)
+				d->fv[k].nvmlReturn = res;
+			continue;
+		}
+		gpu->hasDcgm = 1;
+		if (!d->probed)
+			probe(gpu, d);
+	}
+
+	// and render them family by family
+	for (k = 0; k < fields.count; k++) {
+		psb_clear(sbv);
+		for (i = 0; i < devs; i++) {
+			d = devList[i].dcgm;
+			if (d == NULL || devList[i].hasDcgm != 1)
+				continue;
+			n = d->slot[k];
+			fv = fields.f[k].get != NULL
+				? &(d->dv[k]) : (n < 0 ? NULL : &(d->fv[n]));
+			if (fv == NULL || fv->nvmlReturn != NVML_SUCCESS)
+				continue;
+			render(buf, sizeof(buf), fields.f[k].name, d->labels, fv,
+				fields.f[k].scale);
+			psb_add_str(sbv, buf);
+		}
+		if (psb_len(sbv) == 0)
+			continue;
+		if (!compact) {
+			psb_add_str(sb, "\n# HELP ");
+			psb_add_str(sb, fields.f[k].name);
+			psb_add_char(sb, ' ');
+			psb_add_str(sb, fields.f[k].help);
+			psb_add_str(sb, "\n# TYPE ");
+			psb_add_str(sb, fields.f[k].name);
+			psb_add_str(sb, fields.f[k].counter ? " counter\n" : " gauge\n");
+		}
+		psb_add_str(sb, psb_str(sbv));
+	}
+	psb_destroy(sbv);
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
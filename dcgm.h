@@ -0,0 +1,61 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file dcgm.h
+ * NVML field values exported under the metric names of dcgm-exporter.
+ */
+
+#ifndef NVMEX_DCGM_H
+#define NVMEX_DCGM_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Load the fields to export from the given CSV file. Each line consists of
+ * an optional numeric ID, the DCGM field name (with or without the
+ * \c DCGM_FI_ prefix), the prom metric type and the help text. Empty lines
+ * and lines starting with a \c # get skipped as well as fields whose name
+ * starts with a \c # (disabled). Fields without an NVML counterpart get
+ * logged and ignored, so do invalid lines.
+ * @param file	the CSV file to load. If \c NULL , forget all fields.
+ * @return \c 0 on success, \c 1 if the file is not readable.
+ */
+int setFieldsFile(const char *file);
+
+/**
+ * Get the values of all loaded fields using a single NVML call per GPU for
+ * all NVML field values, and one call per GPU for each NVML source the
+ * derived fields need (clocks, temperature, utilization, framebuffer, ...).
+ * Fields sharing a source share its result.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getDcgm(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+/**
+ * Free the field value buffers of the given GPU.
+ * @param gpu	the GPU whose buffers should be freed.
+ */
+void freeDcgm(gpu_t *gpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_DCGM_H
@@ -9,10 +9,13 @@
  * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include "ecc.h"
+#include "rcache.h"
 
 // cat nvml.h | gsed -rne '/^#define NVML_FI_DEV_ECC_/ { s/^#define NVML_FI_DEV_ECC_/	"/; s|[[:space:]] *([0-9]+)[[:space:]]+//!<|",	// \1 |; s/ (single|double).*//; s/CBU/Convergence Barrier Unit/; s/TOTAL/ALL/; p; }'
 
@@ -49,18 +52,180 @@ static const char *ename[] = {
 	"DBE_AGG_CBU"	// 28  Convergence Barrier Unit
 };
 
+_Static_assert(sizeof(ename)/sizeof(char *) == RC_ECC_ERRS,
+	"render cache slots do not match ECC counters");
+
+// the first TOTALS entries of ename are the aggregates of all locations
+#define TOTALS 4
+// number of NVML calls needed to read the retired pages
+#define PAGES 3
+
+/*
+ * Per GPU state of the incremental collection: the per location counters and
+ * retired pages get read only, if a total changed or an ECC event arrived.
+ */
+typedef struct ecc_st {
+	unsigned long long	val[RC_ECC_ERRS];	//!< last read values
+	bool	has[RC_ECC_ERRS];		//!< val got read successfully
+	uint	pages[PAGES];			//!< retired pages sbe, dbe, pending
+	bool	hasPages[PAGES];		//!< pages got read successfully
+	uint	events;					//!< eccEvents seen on the last collection
+	bool	valid;					//!< false .. full refresh needed
+	bool	dirty;					//!< read per location counters and pages
+	unsigned long long	skippedCalls;	//!< NVML calls not made
+	unsigned long long	extraCalls;		//!< NVML calls made additionally
+	unsigned long long	skippedFields;	//!< NVML field values not read
+} ecc_t;
+
+static atomic_uint eccEvents = 0;
+static bool skipZero = false;
+
+void
+setEccSkipZero(bool skip) {
+	skipZero = skip;
+}
+
+void
+eccEvent(void) {
+	atomic_fetch_add(&eccEvents, 1);
+}
+
+void
+freeECC(gpu_t *gpu) {
+	free(gpu->ecc);
+	gpu->ecc = NULL;
+}
+
+/*
+ * Allocate the state of all GPUs if not yet done and mark those, which need
+ * a full refresh because not read yet or an ECC event arrived meanwhile.
+ */
+static void
+checkState(uint devs, gpu_t devList[]) {
+	ecc_t *e;
+	uint i, ev = atomic_load(&eccEvents);
+
+	for (i = 0; i < devs; i++) {
+		if (devList[i].dev == NULL)
+			continue;
+		if (devList[i].ecc == NULL) {
+			devList[i].ecc = calloc(1, sizeof(ecc_t));
+			if (devList[i].ecc == NULL)
+				continue;
+		}
+		e = devList[i].ecc;
+		e->dirty = !e->valid || e->events != ev;
+		e->events = ev;
+		e->valid = true;
+	}
+}
+
+/*
+ * Read the totals and if they changed or a refresh is needed anyway, the
+ * per location counters as well. Returns false on error. Reading all
+ * counters at once would take a single call, so the call for the totals
+ * saves nothing, and reading the per location counters costs an extra one.
+ */
+static bool
+readErrors(gpu_t *gpu, ecc_t *e, nvmlFieldValue_t *fvals) {
+	nvmlReturn_t res;
+	uint k, max = sizeof(ename)/sizeof(char *);
+	bool ok;
+
+	for (k = 0; k < TOTALS; k++)
+		fvals[k].fieldId = k + _OFFSET;
+	res = nvmlDeviceGetFieldValues(gpu->dev, TOTALS, fvals);
+	if (NVML_SUCCESS != res)
+		return false;
+	for (k = 0; k < TOTALS; k++) {
+		ok = fvals[k].nvmlReturn == NVML_SUCCESS;
+		if (ok != e->has[k] || (ok && fvals[k].value.ullVal != e->val[k]))
+			e->dirty = true;
+		e->has[k] = ok;
+		if (ok)
+			e->val[k] = fvals[k].value.ullVal;
+	}
+	if (!e->dirty) {
+		e->skippedFields += max - TOTALS;
+		return true;
+	}
+
+	PROM_DEBUG("GPU %u: reading ECC counters per location", gpu->idx);
+	for (k = TOTALS; k < max; k++)
+		fvals[k - TOTALS].fieldId = k + _OFFSET;
+	res = nvmlDeviceGetFieldValues(gpu->dev, max - TOTALS, fvals);
+	e->extraCalls++;
+	if (NVML_SUCCESS != res && !NOT_AVAIL(res))
+		e->valid = false;	// try again next time
+	for (k = TOTALS; k < max; k++) {
+		e->has[k] = NVML_SUCCESS == res
+			&& fvals[k - TOTALS].nvmlReturn == NVML_SUCCESS;
+		if (e->has[k])
+			e->val[k] = fvals[k - TOTALS].value.ullVal;
+	}
+	return true;
+}
+
+/*
+ * Returns false if retired pages are not supported by the GPU. Only a
+ * transient error of one of the calls forces a full refresh on the next
+ * collection, a call the GPU does not support just leaves its value unset.
+ */
+static bool
+readPages(gpu_t *gpu, ecc_t *e) {
+	nvmlReturn_t res;
+	nvmlEnableState_t state;
+	uint k = 0;
+	bool retry = false;
+
+	if (!e->dirty) {
+		e->skippedCalls += PAGES;
+		return true;
+	}
+	memset(e->hasPages, 0, sizeof(e->hasPages));
+	res = nvmlDeviceGetRetiredPages(gpu->dev,
+		NVML_PAGE_RETIREMENT_CAUSE_MULTIPLE_SINGLE_BIT_ECC_ERRORS, &k, NULL);
+	if (NVML_SUCCESS == res) {
+		e->pages[0] = k;
+		e->hasPages[0] = true;
+	} else if (NOT_AVAIL(res)) {
+		return false;
+	} else {
+		retry = true;
+	}
+	res = nvmlDeviceGetRetiredPages(gpu->dev,
+		NVML_PAGE_RETIREMENT_CAUSE_DOUBLE_BIT_ECC_ERROR, &k, NULL);
+	if (NVML_SUCCESS == res) {
+		e->pages[1] = k;
+		e->hasPages[1] = true;
+	} else if (!NOT_AVAIL(res)) {
+		retry = true;
+	}
+	res = nvmlDeviceGetRetiredPagesPendingStatus(gpu->dev, &state);
+	if (NVML_SUCCESS == res) {
+		e->pages[2] = state;
+		e->hasPages[2] = true;
+	} else if (!NOT_AVAIL(res)) {
+		retry = true;
+	}
+	if (retry)
+		e->valid = false;	// try again next time
+	return true;
+}
+
 bool
 getECC(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	nvmlReturn_t res;
 	gpu_t *gpu;
+	ecc_t *e;
 	size_t sz;
 	uint i, k, max;
-	char buf[MBUF_SZ];
 	bool free_sb = sb == NULL;
 	nvmlFieldValue_t *fvals = NULL;
-	psb_t *sbe, *sbp, *sbr; // buffer for error + retired pages + remapped rows
-   	sbe = sbp = sbr = NULL;
+	psb_t *sbe, *sbs, *sbx; // buffer for errors + skipped + extra calls
+   	sbe = sbs = sbx = NULL;
 	nvmlEnableState_t state;
+	char buf[MBUF_SZ];
 
 	if (devs == 0)
 		return false;
@@ -70,27 +235,30 @@ getECC(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		sb = psb_new();
 	sz = psb_len(sb);
 
+	checkState(devs, devList);
 	if (!compact)
 		addPromInfo(NVMEXM_ECC_MODE);
 
+	max = sizeof(ename)/sizeof(char *);
 	for (i = 0; i < devs; i++) {
 		nvmlEnableState_t current = 0;
 
 		gpu = &(devList[i]);
-		if (gpu->dev == NULL || gpu->hasECC == -1)
+		if (gpu->dev == NULL || gpu->hasECC == -1 || gpu->ecc == NULL)
 			continue;
+		e = gpu->ecc;
 
 		// mode
 		res = nvmlDeviceGetEccMode(gpu->dev, &current, &state);
 		if (NVML_SUCCESS == res) {
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_MODE_N
+			psb_add_str(sb, rcRender(gpu, RC_ECC_MODE_CURRENT, current,
+				NVMEXM_ECC_MODE_N
 				"{gpu=\"%d\",mode=\"current\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, current);
-			psb_add_str(sb, buf);
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_MODE_N
+				gpu->idx, gpu->uuid, current));
+			psb_add_str(sb, rcRender(gpu, RC_ECC_MODE_PENDING, state,
+				NVMEXM_ECC_MODE_N
 				"{gpu=\"%d\",mode=\"pending\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, state);
-			psb_add_str(sb, buf);
+				gpu->idx, gpu->uuid, state));
 			gpu->hasECC = 1;
 		} else if (NOT_AVAIL(res)) {
 			PROM_DEBUG("gpu.hasECC = -1", "");
@@ -100,7 +268,6 @@ getECC(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			continue;
 
 		// errors
-		max = sizeof(ename)/sizeof(char *);
 		if (fvals == NULL) {
 			fvals = malloc(sizeof(nvmlFieldValue_t) * max);
 			if (fvals == NULL)
@@ -112,25 +279,20 @@ getECC(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			if (sbe == NULL)
 				continue;
 		}
-		for (k = 0; k < max; k++)
-			fvals[k].fieldId = k + _OFFSET;
-		res = nvmlDeviceGetFieldValues(gpu->dev, max, fvals);
-		if (NVML_SUCCESS != res)
+		if (!readErrors(gpu, e, fvals))
 			continue;
 		for (k = 0; k < max; k++) {
-			if (fvals[k].nvmlReturn != NVML_SUCCESS)
+			if (!e->has[k] || (skipZero && k >= TOTALS && e->val[k] == 0))
 				continue;
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_ERR_N
+			psb_add_str(sbe, rcRender(gpu, RC_ECC_ERR + k, e->val[k],
+				NVMEXM_ECC_ERR_N
 				"{gpu=\"%d\",type=\"%s\",counter=\"%s\",loc=\"%s\",uuid=\"%s\"}"
-				//" %d"
 			    " %llu\n",
-				i, (ename[k][0] == 'S' ? "sbe" : "dbe"),
+				gpu->idx, (ename[k][0] == 'S' ? "sbe" : "dbe"),
 				(ename[k][4] == 'V' ? "volatile" : "persistent"),
 				ename[k] + 8,
 				gpu->uuid,
-				//fvals[k].valueType,
-				fvals[k].value.ullVal);
-			psb_add_str(sbe, buf);
+				e->val[k]));
 		}
 	}
 
@@ -146,38 +308,67 @@ getECC(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		addPromInfo(NVMEXM_ECC_PAGE);
 	for (i = 0; i < devs; i++) {
 		gpu = &(devList[i]);
-		if (gpu->dev == NULL || gpu->hasRetiredPages == -1)
+		if (gpu->dev == NULL || gpu->hasRetiredPages == -1 || gpu->ecc == NULL)
 			continue;
-		k = 0;
-		res = nvmlDeviceGetRetiredPages(gpu->dev,
-			NVML_PAGE_RETIREMENT_CAUSE_MULTIPLE_SINGLE_BIT_ECC_ERRORS, &k,NULL);
-		if (NVML_SUCCESS == res) {
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_PAGE_N
-				"{gpu=\"%d\",type=\"sbe\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, k);
-			psb_add_str(sb, buf);
-			gpu->hasRetiredPages = 1;
-		} else if (NOT_AVAIL(res)) {
+		e = gpu->ecc;
+		if (!readPages(gpu, e)) {
 			PROM_DEBUG("gpu.hasRetiredPages = -1", "");
 			gpu->hasRetiredPages = -1;
 			continue;
 		}
-		res = nvmlDeviceGetRetiredPages(gpu->dev,
-			NVML_PAGE_RETIREMENT_CAUSE_DOUBLE_BIT_ECC_ERROR, &k, NULL);
-		if (NVML_SUCCESS == res) {
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_PAGE_N
-				"{gpu=\"%d\",type=\"dbe\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, k);
-			psb_add_str(sb, buf);
+		if (e->hasPages[0]) {
+			psb_add_str(sb, rcRender(gpu, RC_ECC_PAGE_SBE, e->pages[0],
+				NVMEXM_ECC_PAGE_N "{gpu=\"%d\",type=\"sbe\",uuid=\"%s\"} %u\n",
+				gpu->idx, gpu->uuid, e->pages[0]));
+			gpu->hasRetiredPages = 1;
 		}
-		res = nvmlDeviceGetRetiredPagesPendingStatus(gpu->dev, &state);
-		if (NVML_SUCCESS == res) {
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_PAGE_N
-				"{gpu=\"%d\",type=\"pending\",uuid=\"%s\"} %d\n",
-				i, gpu->uuid, state);
-			psb_add_str(sb, buf);
+		if (e->hasPages[1]) {
+			psb_add_str(sb, rcRender(gpu, RC_ECC_PAGE_DBE, e->pages[1],
+				NVMEXM_ECC_PAGE_N "{gpu=\"%d\",type=\"dbe\",uuid=\"%s\"} %u\n",
+				gpu->idx, gpu->uuid, e->pages[1]));
 		}
+		if (e->hasPages[2]) {
+			psb_add_str(sb, rcRender(gpu, RC_ECC_PAGE_PENDING, e->pages[2],
+				NVMEXM_ECC_PAGE_N
+				"{gpu=\"%d\",type=\"pending\",uuid=\"%s\"} %u\n",
+				gpu->idx, gpu->uuid, e->pages[2]));
+		}
+	}
+
+	// what the incremental collection saved
+	sbs = psb_new();
+	for (i = 0; sbs != NULL && i < devs; i++) {
+		e = devList[i].ecc;
+		if (devList[i].dev == NULL || e == NULL)
+			continue;
+		snprintf(buf, sizeof(buf), NVMEXM_ECC_SKIP_N
+			"{gpu=\"%d\",type=\"calls\",uuid=\"%s\"} %llu\n"
+			NVMEXM_ECC_SKIP_N
+			"{gpu=\"%d\",type=\"fields\",uuid=\"%s\"} %llu\n",
+			devList[i].idx, devList[i].uuid, e->skippedCalls,
+			devList[i].idx, devList[i].uuid, e->skippedFields);
+		psb_add_str(sbs, buf);
+		if (sbx == NULL)
+			sbx = psb_new();
+		if (sbx == NULL)
+			continue;
+		snprintf(buf, sizeof(buf), NVMEXM_ECC_EXTRA_N
+			"{gpu=\"%d\",uuid=\"%s\"} %llu\n",
+			devList[i].idx, devList[i].uuid, e->extraCalls);
+		psb_add_str(sbx, buf);
+	}
+	if (sbs != NULL && psb_len(sbs) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_ECC_SKIP);
+		psb_add_str(sb, psb_str(sbs));
+	}
+	psb_destroy(sbs);
+	if (sbx != NULL && psb_len(sbx) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_ECC_EXTRA);
+		psb_add_str(sb, psb_str(sbx));
 	}
+	psb_destroy(sbx);
 #ifdef LEGACY
 #undef NVML_FI_DEV_REMAPPED_COR
 #endif
@@ -192,22 +383,20 @@ getECC(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			continue;
 		res = nvmlDeviceGetRemappedRows(gpu->dev, &k, &max, &p, &e);
 		if (NVML_SUCCESS == res) {
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_ROW_N
+			psb_add_str(sb, rcRender(gpu, RC_ECC_ROW_UNCORR, k, NVMEXM_ECC_ROW_N
 				"{gpu=\"%d\",type=\"uncorrectable\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, k);
-			psb_add_str(sb, buf);
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_ROW_N
+				gpu->idx, gpu->uuid, k));
+			psb_add_str(sb, rcRender(gpu, RC_ECC_ROW_CORR, max, NVMEXM_ECC_ROW_N
 				"{gpu=\"%d\",type=\"correctable\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, max);
-			psb_add_str(sb, buf);
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_ROW_N
+				gpu->idx, gpu->uuid, max));
+			psb_add_str(sb, rcRender(gpu, RC_ECC_ROW_PENDING, p,
+				NVMEXM_ECC_ROW_N
 				"{gpu=\"%d\",type=\"pending\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, p);
-			psb_add_str(sb, buf);
-			snprintf(buf, sizeof(buf), NVMEXM_ECC_ROW_N
+				gpu->idx, gpu->uuid, p));
+			psb_add_str(sb, rcRender(gpu, RC_ECC_ROW_FAILURE, e,
+				NVMEXM_ECC_ROW_N
 				"{gpu=\"%d\",type=\"failure\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, e);
-			psb_add_str(sb, buf);
+				gpu->idx, gpu->uuid, e));
 			gpu->hasRemappedRows = 1;
 		} else if (NOT_AVAIL(res)) {
 			PROM_DEBUG("gpu.hasRetiredPages = -1", "");
@@ -25,7 +25,9 @@ extern "C" {
 #endif
 
 /**
- * Get ECC metrics.
+ * Get ECC metrics. The counters per location and the retired pages get read
+ * only, if one of the totals changed or an ECC event arrived since the last
+ * call (see \c eccEvent() ).
  * @param sb	where to append the metrics.
  * @param compact	If \c true do not add prom descriptions and type comments.
  * @param devs	number of devices in \c devList.
@@ -34,6 +36,25 @@ extern "C" {
  */
 bool getECC(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
 
+/**
+ * Whether to omit the ECC error counters per location, which are \c 0 .
+ * The totals get always reported.
+ * @param skip	If \c true , omit them.
+ */
+void setEccSkipZero(bool skip);
+
+/**
+ * Tell the ECC collector that an ECC error event arrived, so that all
+ * counters get read on its next invocation. Thread safe.
+ */
+void eccEvent(void);
+
+/**
+ * Free the ECC state of the given GPU.
+ * @param gpu	the GPU whose state should be freed.
+ */
+void freeECC(gpu_t *gpu);
+
 #ifdef __cplusplus
 }
 #endif
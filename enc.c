@@ -95,15 +95,15 @@ getEnc(psb_t *sb, bool compact, uint devs, gpu_t devList[], bool full) {
 		if (NVML_SUCCESS == res) {
 			snprintf(buf, sizeof(buf),
 				NVMEXM_ENCSTAT_SESS_N "{gpu=\"%d\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, sessions);
+				gpu->idx, gpu->uuid, sessions);
 			psb_add_str(sb, buf);
 			snprintf(buf, sizeof(buf),
 				NVMEXM_ENCSTAT_FPS_N "{gpu=\"%d\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, fps);
+				gpu->idx, gpu->uuid, fps);
 			psb_add_str(sb_fps, buf);
 			snprintf(buf, sizeof(buf),
 				NVMEXM_ENCSTAT_LAT_N "{gpu=\"%d\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, latency);
+				gpu->idx, gpu->uuid, latency);
 			psb_add_str(sb_lat, buf);
 			gpu->hasEncStats = 1;
 			if (full && sessions > 0 && gpu->hasEncSessions != -1)
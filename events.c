@@ -0,0 +1,284 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "events.h"
+#include "modules.h"
+#include "ecc.h"
+
+#if LEGACY
+// driver <= 390
+#define nvmlEventSetWait_v2 nvmlEventSetWait
+#endif
+
+#ifndef nvmlEventTypePowerSourceChange
+#define nvmlEventTypePowerSourceChange 0
+#endif
+
+#define EVENTS (nvmlEventTypeXidCriticalError \
+	| nvmlEventTypeSingleBitEccError | nvmlEventTypeDoubleBitEccError \
+	| nvmlEventTypeClock | nvmlEventTypePowerSourceChange)
+
+// max. time in ms the thread waits for an event before checking for stop
+#define WAIT_MS 1000
+
+typedef struct xid_st {
+	gpu_t	*gpu;
+	uint	xid;
+	unsigned long long	count;
+} xid_t;
+
+static struct {
+	nvmlEventSet_t	set;
+	pthread_t	thread;
+	atomic_bool	stop;
+	bool	running;
+	uint	devs;
+	gpu_t	*devList;
+} ev = { .set = NULL, .running = false };
+
+static pthread_mutex_t xidLock = PTHREAD_MUTEX_INITIALIZER;
+static xid_t *xids = NULL;
+static uint xidCount = 0;
+static uint xidMax = 0;
+
+void
+countXid(gpu_t *gpu, uint xid) {
+	xid_t *x;
+	uint i;
+
+	pthread_mutex_lock(&xidLock);
+	for (i = 0; i < xidCount; i++) {
+		if (xids[i].gpu == gpu && xids[i].xid == xid) {
+			xids[i].count++;
+			goto end;
+		}
+	}
+	if (xidCount == xidMax) {
+		x = realloc(xids, sizeof(xid_t) * (xidMax + 16));
+		if (x == NULL)
+			goto end;
+		xids = x;
+		xidMax += 16;
+	}
+	xids[xidCount].gpu = gpu;
+	xids[xidCount].xid = xid;
+	xids[xidCount].count = 1;
+	xidCount++;
+
+end:
+	pthread_mutex_unlock(&xidLock);
+}
+
+static gpu_t *
+findGPU(nvmlDevice_t dev) {
+	uint i;
+
+	for (i = 0; i < ev.devs; i++) {
+		if (ev.devList[i].dev == dev)
+			return &(ev.devList[i]);
+	}
+	return NULL;
+}
+
+static void *
+eventLoop(void *arg) {
+	nvmlReturn_t res;
+	nvmlEventData_t data;
+	gpu_t *gpu;
+
+	(void) arg;
+	PROM_DEBUG("Event thread started", "");
+	while (!atomic_load(&(ev.stop))) {
+		res = nvmlEventSetWait_v2(ev.set, &data, WAIT_MS);
+		if (res == NVML_ERROR_TIMEOUT)
+			continue;
+		if (res != NVML_SUCCESS) {
+			PROM_WARN("Waiting for NVML events failed: %s", nverror(res));
+			sleep(1);
+			continue;
+		}
+		gpu = findGPU(data.device);
+		if (gpu == NULL)
+			continue;
+		PROM_DEBUG("GPU %u: event 0x%llx data %llu", gpu->idx,
+			data.eventType, data.eventData);
+		if (data.eventType & nvmlEventTypeXidCriticalError) {
+			countXid(gpu, data.eventData);
+			modInvalidate("xid");
+		}
+		if (data.eventType
+			& (nvmlEventTypeSingleBitEccError | nvmlEventTypeDoubleBitEccError))
+		{
+			eccEvent();
+			modInvalidate("ecc");
+		}
+		if (data.eventType & nvmlEventTypeClock)
+			modInvalidate("clock");
+		if (data.eventType & nvmlEventTypePowerSourceChange)
+			modInvalidate("power");
+	}
+	PROM_DEBUG("Event thread stopped", "");
+	return NULL;
+}
+
+// the event types, which invalidate the output of a module
+static const struct {
+	const char	*name;		//!< module name
+	unsigned long long	types;
+} evmod[] = {
+	{ "xid", nvmlEventTypeXidCriticalError },
+	{ "ecc", nvmlEventTypeSingleBitEccError | nvmlEventTypeDoubleBitEccError },
+	{ "clock", nvmlEventTypeClock },
+	{ "power", nvmlEventTypePowerSourceChange },
+};
+#define EVMODS (sizeof(evmod)/sizeof(evmod[0]))
+
+bool
+eventsCover(const char *name) {
+	uint i, k;
+
+	if (!ev.running)
+		return false;
+	for (k = 0; k < EVMODS && strcmp(evmod[k].name, name) != 0; k++)
+		;
+	if (k == EVMODS || evmod[k].types == 0)
+		return false;
+	for (i = 0; i < ev.devs; i++) {
+		if (ev.devList[i].dev != NULL
+			&& (ev.devList[i].events & evmod[k].types) != evmod[k].types)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint
+startEvents(uint devs, gpu_t devList[]) {
+	nvmlReturn_t res;
+	unsigned long long types;
+	uint i, n = 0;
+	gpu_t *gpu;
+	int err;
+
+	if (ev.running || devs == 0)
+		return 1;
+
+	res = nvmlEventSetCreate(&(ev.set));
+	if (res != NVML_SUCCESS) {
+		PROM_WARN("Unable to create NVML event set: %s", nverror(res));
+		return 1;
+	}
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		gpu->events = 0;
+		if (gpu->dev == NULL)
+			continue;
+		res = nvmlDeviceGetSupportedEventTypes(gpu->dev, &types);
+		if (res != NVML_SUCCESS || (types & EVENTS) == 0) {
+			PROM_DEBUG("GPU %u: no events supported", gpu->idx);
+			continue;
+		}
+		res = nvmlDeviceRegisterEvents(gpu->dev, types & EVENTS, ev.set);
+		if (res != NVML_SUCCESS) {
+			PROM_INFO("GPU %u: unable to register events: %s", gpu->idx,
+				nverror(res));
+			continue;
+		}
+		gpu->events = types & EVENTS;
+		n++;
+	}
+	if (n == 0)
+		goto fail;
+
+	ev.devs = devs;
+	ev.devList = devList;
+	atomic_store(&(ev.stop), false);
+	err = pthread_create(&(ev.thread), NULL, eventLoop, NULL);
+	if (err != 0) {
+		PROM_WARN("Unable to start event thread (error %d)", err);
+		for (i = 0; i < devs; i++)
+			devList[i].events = 0;
+		goto fail;
+	}
+	ev.running = true;
+	return 0;
+
+fail:
+	nvmlEventSetFree(ev.set);
+	ev.set = NULL;
+	return 1;
+}
+
+void
+stopEvents(void) {
+	if (ev.running) {
+		atomic_store(&(ev.stop), true);
+		pthread_join(ev.thread, NULL);
+		ev.running = false;
+	}
+	if (ev.set != NULL) {
+		nvmlEventSetFree(ev.set);
+		ev.set = NULL;
+	}
+	pthread_mutex_lock(&xidLock);
+	free(xids);
+	xids = NULL;
+	xidCount = xidMax = 0;
+	pthread_mutex_unlock(&xidLock);
+}
+
+bool
+getXid(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	size_t sz;
+	uint i, k;
+	char buf[MBUF_SZ];
+	bool free_sb = sb == NULL;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getXid", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_XID);
+	pthread_mutex_lock(&xidLock);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		for (k = 0; k < xidCount; k++) {
+			if (xids[k].gpu != gpu)
+				continue;
+			snprintf(buf, sizeof(buf),
+				NVMEXM_XID_N "{gpu=\"%d\",xid=\"%u\",uuid=\"%s\"} %llu\n",
+				gpu->idx, xids[k].xid, gpu->uuid, xids[k].count);
+			psb_add_str(sb, buf);
+		}
+	}
+	pthread_mutex_unlock(&xidLock);
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file events.h
+ * Event thread, which waits for NVML events (Xid errors, ECC errors, clock
+ * and power source changes), counts Xid errors and invalidates the cached
+ * output of the related modules.
+ */
+
+#ifndef NVMEX_EVENTS_H
+#define NVMEX_EVENTS_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Register all supported events of interest for the given devices and start
+ * the event thread. Sets \c gpu_t.events of each device accordingly.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to watch. Must not be \c NULL and must
+ *	stay valid until \c stopEvents() got called!
+ * @return \c 0 on success, a number > 0 if no event could be registered or
+ *	the thread could not be started.
+ */
+uint startEvents(uint devs, gpu_t devList[]);
+
+/**
+ * Check whether the output of the given module gets invalidated by events,
+ * i.e. the event thread is running and all GPUs registered the event types
+ * related to the module.
+ * @param name	name of the module as used by option \c -n .
+ * @return \c true if so, \c false otherwise.
+ */
+bool eventsCover(const char *name);
+
+/**
+ * Stop the event thread (if running) and release all related resources.
+ */
+void stopEvents(void);
+
+/**
+ * Count a Xid error for the given device. May be called from any thread.
+ * @param gpu	the device which reported the error.
+ * @param xid	the Xid of the error.
+ */
+void countXid(gpu_t *gpu, uint xid);
+
+/**
+ * Get Xid error counters.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getXid(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_EVENTS_H
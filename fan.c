@@ -38,7 +38,7 @@ getFan(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		if (NVML_SUCCESS == res) {
 			snprintf(buf, sizeof(buf),
 				NVMEXM_FAN_N "{gpu=\"%d\",value=\"intended\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, speed);
+				gpu->idx, gpu->uuid, speed);
 			psb_add_str(sb, buf);
 			gpu->hasFan = 1;
 		} else if (NOT_AVAIL(res)) {
@@ -111,15 +111,15 @@ getFBC(psb_t *sb, bool compact, uint devs, gpu_t devList[], bool full) {
 		if (NVML_SUCCESS == res) {
 			snprintf(buf, sizeof(buf),
 				NVMEXM_FBCSTAT_SESS_N "{gpu=\"%d\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, stats.sessionsCount);
+				gpu->idx, gpu->uuid, stats.sessionsCount);
 			psb_add_str(sb, buf);
 			snprintf(buf, sizeof(buf),
 				NVMEXM_FBCSTAT_FPS_N "{gpu=\"%d\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, stats.averageFPS);
+				gpu->idx, gpu->uuid, stats.averageFPS);
 			psb_add_str(sb_fps, buf);
 			snprintf(buf, sizeof(buf),
 				NVMEXM_FBCSTAT_LAT_N "{gpu=\"%d\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, stats.averageLatency);
+				gpu->idx, gpu->uuid, stats.averageLatency);
 			psb_add_str(sb_lat, buf);
 			gpu->hasFbcStats = 1;
 			if (full && stats.sessionsCount > 0 && gpu->hasFbcSessions != -1)
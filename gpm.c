@@ -0,0 +1,287 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "gpm.h"
+
+#ifdef NVML_GPM_METRICS_GET_VERSION
+
+// time in ms between the two samples of a pair
+#define GPM_INTERVAL_MS 1000
+
+enum { KIND_UTIL, KIND_BW };
+
+static const struct {
+	nvmlGpmMetricId_t	id;
+	uint	kind;
+	const char	*label;		//!< label(s) of the prom metric
+} metric[] = {
+	{ NVML_GPM_METRIC_GRAPHICS_UTIL, KIND_UTIL, "metric=\"graphics\"" },
+	{ NVML_GPM_METRIC_SM_UTIL, KIND_UTIL, "metric=\"sm_active\"" },
+	{ NVML_GPM_METRIC_SM_OCCUPANCY, KIND_UTIL, "metric=\"sm_occupancy\"" },
+	{ NVML_GPM_METRIC_ANY_TENSOR_UTIL, KIND_UTIL, "metric=\"tensor\"" },
+	{ NVML_GPM_METRIC_DFMA_TENSOR_UTIL, KIND_UTIL, "metric=\"tensor_dfma\"" },
+	{ NVML_GPM_METRIC_HMMA_TENSOR_UTIL, KIND_UTIL, "metric=\"tensor_hmma\"" },
+	{ NVML_GPM_METRIC_IMMA_TENSOR_UTIL, KIND_UTIL, "metric=\"tensor_imma\"" },
+	{ NVML_GPM_METRIC_FP64_UTIL, KIND_UTIL, "metric=\"fp64\"" },
+	{ NVML_GPM_METRIC_FP32_UTIL, KIND_UTIL, "metric=\"fp32\"" },
+	{ NVML_GPM_METRIC_FP16_UTIL, KIND_UTIL, "metric=\"fp16\"" },
+	{ NVML_GPM_METRIC_INTEGER_UTIL, KIND_UTIL, "metric=\"integer\"" },
+	{ NVML_GPM_METRIC_DRAM_BW_UTIL, KIND_UTIL, "metric=\"dram_bw\"" },
+	{ NVML_GPM_METRIC_PCIE_TX_PER_SEC, KIND_BW, "bus=\"pcie\",dir=\"tx\"" },
+	{ NVML_GPM_METRIC_PCIE_RX_PER_SEC, KIND_BW, "bus=\"pcie\",dir=\"rx\"" },
+	{ NVML_GPM_METRIC_NVLINK_TOTAL_TX_PER_SEC, KIND_BW,
+		"bus=\"nvlink\",dir=\"tx\"" },
+	{ NVML_GPM_METRIC_NVLINK_TOTAL_RX_PER_SEC, KIND_BW,
+		"bus=\"nvlink\",dir=\"rx\"" },
+};
+#define METRICS (sizeof(metric)/sizeof(metric[0]))
+
+typedef struct gsampler_st {
+	gpu_t	*gpu;
+	nvmlGpmSample_t	sample[2];	//!< previous and current sample
+	uint	cur;			//!< index of the sample to take next
+	bool	primed;			//!< previous sample is valid
+	bool	has[METRICS];	//!< supported by the GPU
+	double	val[METRICS];	//!< values of the last pair
+	bool	valid;			//!< val[] got set at least once
+} gsampler_t;
+
+static struct {
+	gsampler_t	*s;
+	uint	count;
+	pthread_t	thread;
+	atomic_bool	stop;
+	pthread_mutex_t	lock;	//!< protects has, val and valid of all samplers
+} gpm = { .s = NULL, .count = 0, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void
+update(gsampler_t *s) {
+	nvmlReturn_t res;
+	nvmlGpmMetricsGet_t mg;
+	uint k, prev = s->cur ^ 1;
+
+	res = nvmlGpmSampleGet(s->gpu->dev, s->sample[s->cur]);
+	if (NVML_SUCCESS != res) {
+		s->primed = false;
+		return;
+	}
+	if (!s->primed) {
+		s->primed = true;
+		s->cur = prev;
+		return;
+	}
+	memset(&mg, 0, sizeof(mg));
+	mg.version = NVML_GPM_METRICS_GET_VERSION;
+	mg.numMetrics = METRICS;
+	mg.sample1 = s->sample[prev];
+	mg.sample2 = s->sample[s->cur];
+	for (k = 0; k < METRICS; k++)
+		mg.metrics[k].metricId = metric[k].id;
+	res = nvmlGpmMetricsGet(&mg);
+	s->cur = prev;
+	if (NVML_SUCCESS != res)
+		return;
+	pthread_mutex_lock(&(gpm.lock));
+	for (k = 0; k < METRICS; k++) {
+		s->has[k] = mg.metrics[k].nvmlReturn == NVML_SUCCESS;
+		if (s->has[k])
+			s->val[k] = mg.metrics[k].value;
+	}
+	s->valid = true;
+	pthread_mutex_unlock(&(gpm.lock));
+}
+
+static void *
+gpmLoop(void *arg) {
+	struct timespec ts;
+	uint i;
+
+	(void) arg;
+	PROM_DEBUG("GPM sampler started", "");
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	while (!atomic_load(&(gpm.stop))) {
+		for (i = 0; i < gpm.count; i++)
+			update(&(gpm.s[i]));
+		ts.tv_sec += GPM_INTERVAL_MS / 1000;
+		ts.tv_nsec += (GPM_INTERVAL_MS % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec -= 1000000000L;
+			ts.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	PROM_DEBUG("GPM sampler stopped", "");
+	return NULL;
+}
+
+static void
+freeSamples(gsampler_t *s) {
+	if (s->sample[0] != NULL)
+		nvmlGpmSampleFree(s->sample[0]);
+	if (s->sample[1] != NULL)
+		nvmlGpmSampleFree(s->sample[1]);
+	s->sample[0] = s->sample[1] = NULL;
+}
+
+uint
+startGpm(uint devs, gpu_t devList[]) {
+	nvmlReturn_t res;
+	nvmlGpmSupport_t support;
+	gsampler_t *s;
+	gpu_t *gpu;
+	uint i, k;
+
+	if (gpm.s != NULL || devs == 0)
+		return 1;
+	gpm.s = calloc(devs, sizeof(gsampler_t));
+	if (gpm.s == NULL)
+		return 1;
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL)
+			continue;
+		memset(&support, 0, sizeof(support));
+		support.version = NVML_GPM_SUPPORT_VERSION;
+		res = nvmlGpmQueryDeviceSupport(gpu->dev, &support);
+		if (NVML_SUCCESS != res || !support.isSupportedDevice) {
+			PROM_DEBUG("GPU %u: no GPM support", gpu->idx);
+			gpu->hasGpm = -1;
+			continue;
+		}
+		s = &(gpm.s[gpm.count]);
+		if (nvmlGpmSampleAlloc(&(s->sample[0])) != NVML_SUCCESS
+			|| nvmlGpmSampleAlloc(&(s->sample[1])) != NVML_SUCCESS)
+		{
+			freeSamples(s);
+			continue;
+		}
+		s->gpu = gpu;
+		for (k = 0; k < METRICS; k++)
+			s->has[k] = true;
+		gpu->hasGpm = 1;
+		gpm.count++;
+	}
+	if (gpm.count == 0)
+		goto fail;
+	atomic_store(&(gpm.stop), false);
+	if (pthread_create(&(gpm.thread), NULL, gpmLoop, NULL) != 0) {
+		PROM_WARN("Unable to start GPM sampler", "");
+		for (i = 0; i < gpm.count; i++)
+			freeSamples(&(gpm.s[i]));
+		goto fail;
+	}
+	return 0;
+
+fail:
+	free(gpm.s);
+	gpm.s = NULL;
+	gpm.count = 0;
+	return 1;
+}
+
+void
+stopGpm(void) {
+	uint i;
+
+	if (gpm.s == NULL)
+		return;
+	atomic_store(&(gpm.stop), true);
+	pthread_join(gpm.thread, NULL);
+	for (i = 0; i < gpm.count; i++)
+		freeSamples(&(gpm.s[i]));
+	free(gpm.s);
+	gpm.s = NULL;
+	gpm.count = 0;
+}
+
+static void
+addMetrics(psb_t *sb, uint kind) {
+	gsampler_t *s;
+	uint i, k;
+	char buf[MBUF_SZ];
+
+	for (i = 0; i < gpm.count; i++) {
+		s = &(gpm.s[i]);
+		if (!s->valid)
+			continue;
+		for (k = 0; k < METRICS; k++) {
+			if (metric[k].kind != kind || !s->has[k])
+				continue;
+			snprintf(buf, sizeof(buf), "%s{gpu=\"%d\",%s,uuid=\"%s\"} %.2f\n",
+				kind == KIND_UTIL ? NVMEXM_GPM_UTIL_N : NVMEXM_GPM_BW_N,
+				s->gpu->idx, metric[k].label, s->gpu->uuid, s->val[k]);
+			psb_add_str(sb, buf);
+		}
+	}
+}
+
+bool
+getGpm(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	size_t sz;
+	bool free_sb = sb == NULL;
+
+	(void) devList;
+	if (devs == 0 || gpm.count == 0)
+		return false;
+
+	PROM_DEBUG("getGpm", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	pthread_mutex_lock(&(gpm.lock));
+	if (!compact)
+		addPromInfo(NVMEXM_GPM_UTIL);
+	addMetrics(sb, KIND_UTIL);
+	if (!compact)
+		addPromInfo(NVMEXM_GPM_BW);
+	addMetrics(sb, KIND_BW);
+	pthread_mutex_unlock(&(gpm.lock));
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
+
+#else
+// NVML too old for GPM
+
+uint
+startGpm(uint devs, gpu_t devList[]) {
+	uint i;
+
+	for (i = 0; i < devs; i++)
+		devList[i].hasGpm = -1;
+	return 1;
+}
+
+void
+stopGpm(void) {
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+bool
+getGpm(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	return false;
+}
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,56 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file gpm.h
+ * GPU Performance Monitoring (GPM) metrics like SM occupancy, tensor and FP
+ * pipe utilization or DRAM, PCIe and NvLink bandwidth (Hopper and newer).
+ */
+
+#ifndef NVMEX_GPM_H
+#define NVMEX_GPM_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Start a background thread, which takes a GPM sample of each supported GPU
+ * every second and calculates the metrics of the last two samples.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to sample. Must not be \c NULL and must
+ *	stay valid until \c stopGpm() got called!
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+uint startGpm(uint devs, gpu_t devList[]);
+
+/**
+ * Stop the GPM sampler thread and release related resources.
+ */
+void stopGpm(void);
+
+/**
+ * Get the GPM metrics calculated by the GPM sampler thread.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getGpm(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_GPM_H
@@ -13,6 +13,16 @@
 #include <string.h>
 
 #include "inspect.h"
+#include "rcache.h"
+#include "rate.h"
+#include "pcihealth.h"
+#include "util.h"
+#include "power.h"
+#include "mig.h"
+#include "vgpu.h"
+#include "dcgm.h"
+#include "topo.h"
+#include "ecc.h"
 
 /* nvmlInit_v2() already called */
 static uint started = 0;
@@ -92,12 +102,13 @@ getDevInfos(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		// see also  nvmlDeviceGetArchitecture(dev, &arch): maps arch to string
 		res = nvmlDeviceGetName(gpu->dev, name, NVML_DEVICE_NAME_BUFFER_SIZE);
 		if (NVML_SUCCESS != res) { 
-			PROM_WARN("Failed to get name of device %u: %s\n", i, nverror(res));
+			PROM_WARN("Failed to get name of device %u: %s\n", gpu->idx,
+				nverror(res));
 			name[0] = '\0';
         } else {
 			p += snprintf(buf, sizeof(buf),
 				NVMEXM_GPU_N "{gpu=\"%d\",name=\"%s\",uuid=\"%s\"} 1\n",
-				i, name, gpu->uuid);
+				gpu->idx, name, gpu->uuid);
 		}
 		res = nvmlDeviceGetPciInfo(gpu->dev, &pci);
 		if (NVML_SUCCESS != res) { 
@@ -107,7 +118,7 @@ getDevInfos(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		} else {
 			p += snprintf(p, sizeof(buf) - (p - buf),
 				NVMEXM_GPU_N "{gpu=\"%d\",pci=\"%s\",uuid=\"%s\"} 1\n",
-				i, pci.busId, gpu->uuid);
+				gpu->idx, pci.busId, gpu->uuid);
 		}
 		psb_add_str(sb, buf);
 		gpu->info = strdup(buf);
@@ -115,7 +126,8 @@ getDevInfos(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			nvmlComputeMode_t compute_mode;
 			res = nvmlDeviceGetComputeMode(gpu->dev, &compute_mode);
 			snprintf(buf, MBUF_SZ, "%u. %s [%s]   %sCUDA capable\n",
-				i, name, pci.busId, NVML_ERROR_NOT_SUPPORTED == res ?"not ":"");
+				gpu->idx, name, pci.busId,
+				NVML_ERROR_NOT_SUPPORTED == res ?"not ":"");
 			psb_add_str(sbi, buf);
 		}
 	}
@@ -254,13 +266,143 @@ getUnitInfos(psb_t *sb) {
 	return 0;
 }
 
+typedef struct busorder_st {
+	unsigned long long	bus;	//!< domain, bus and device number
+	uint	idx;				//!< NVML index
+} busorder_t;
+
+static int
+cmpbus(const void *a, const void *b) {
+	unsigned long long x = ((const busorder_t *) a)->bus;
+	unsigned long long y = ((const busorder_t *) b)->bus;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * CUDA numbers its devices on its own: fastest first by default, in PCI bus
+ * order if CUDA_DEVICE_ORDER=PCI_BUS_ID. The former cannot be derived via
+ * NVML, so PCI bus order gets used in both cases. Returns the NVML indices
+ * of all GPUs in this order or NULL on error.
+ */
+static uint *
+getCudaOrder(uint devs) {
+	nvmlReturn_t res;
+	nvmlDevice_t dev;
+	nvmlPciInfo_t pci;
+	busorder_t *o;
+	uint *order, i;
+	const char *env = getenv("CUDA_DEVICE_ORDER");
+
+	if (env == NULL || strcmp(env, "PCI_BUS_ID") != 0)
+		PROM_WARN("CUDA_DEVICE_ORDER is not PCI_BUS_ID - CUDA_VISIBLE_DEVICES "
+			"indices are assumed to be in PCI bus order. Use UUIDs to be "
+			"sure.", "");
+	o = malloc(sizeof(busorder_t) * devs);
+	order = malloc(sizeof(uint) * devs);
+	if (o == NULL || order == NULL)
+		goto fail;
+	for (i = 0; i < devs; i++) {
+		res = nvmlDeviceGetHandleByIndex_v2(i, &dev);
+		if (NVML_SUCCESS == res)
+			res = nvmlDeviceGetPciInfo(dev, &pci);
+		if (NVML_SUCCESS != res) {
+			PROM_WARN("Failed to get PCI bus ID of dev %u: %s", i,
+				nverror(res));
+			goto fail;
+		}
+		o[i].bus = ((unsigned long long) pci.domain << 16)
+			| (pci.bus << 8) | pci.device;
+		o[i].idx = i;
+	}
+	qsort(o, devs, sizeof(busorder_t), cmpbus);
+	for (i = 0; i < devs; i++)
+		order[i] = o[i].idx;
+	free(o);
+	return order;
+
+fail:
+	free(o);
+	free(order);
+	return NULL;
+}
+
+/*
+ * Mark the GPUs to use according to NVIDIA_VISIBLE_DEVICES or - if unset -
+ * CUDA_VISIBLE_DEVICES, which are comma separated lists of device indices or
+ * GPU UUIDs, or 'all', or 'none'. NVIDIA_VISIBLE_DEVICES indices are NVML
+ * indices, CUDA_VISIBLE_DEVICES indices CUDA device numbers (see
+ * getCudaOrder()). Returns NULL if all GPUs should be used.
+ */
+static char *
+getVisibleDevices(uint devs) {
+	nvmlReturn_t res;
+	nvmlDevice_t dev;
+	const char *env, *s, *e;
+	char buf[NVML_DEVICE_UUID_BUFFER_SIZE], *visible, *end;
+	uint n, *order = NULL;
+	bool cuda = false;
+
+	env = getenv("NVIDIA_VISIBLE_DEVICES");
+	if (env == NULL) {
+		env = getenv("CUDA_VISIBLE_DEVICES");
+		cuda = true;
+	}
+	if (env == NULL || strcmp(env, "all") == 0)
+		return NULL;
+
+	visible = calloc(devs, sizeof(char));
+	if (visible == NULL)
+		return NULL;
+	PROM_INFO("Using visible devices '%s' only", env);
+	if (strcmp(env, "none") == 0 || strcmp(env, "void") == 0)
+		return visible;
+
+	for (s = env; *s != '\0'; s = (*e == '\0') ? e : e + 1) {
+		e = strchr(s, ',');
+		if (e == NULL)
+			e = s + strlen(s);
+		if (e == s || (size_t) (e - s) >= sizeof(buf))
+			continue;
+		memcpy(buf, s, e - s);
+		buf[e - s] = '\0';
+		n = strtoul(buf, &end, 10);
+		if (*end != '\0') {
+			// MIG devices belong to its parent GPU, which is not our business
+			res = nvmlDeviceGetHandleByUUID(buf, &dev);
+			if (NVML_SUCCESS == res)
+				res = nvmlDeviceGetIndex(dev, &n);
+			if (NVML_SUCCESS != res) {
+				PROM_WARN("Unable to find visible device '%s': %s", buf,
+					nverror(res));
+				continue;
+			}
+		} else if (cuda && n < devs) {
+			if (order == NULL)
+				order = getCudaOrder(devs);
+			if (order == NULL) {
+				PROM_WARN("Unable to map CUDA device '%s'", buf);
+				continue;
+			}
+			n = order[n];
+		}
+		if (n < devs)
+			visible[n] = 1;
+		else
+			PROM_WARN("Visible device '%s' does not exist", buf);
+	}
+	free(order);
+	return visible;
+}
+
 // Device Queries 2.14
 uint
 getDevices(gpu_t *gpuList[]) {
 	nvmlReturn_t res;
-	uint devs, i, count = 0, k;
+	uint devs, i, count = 0, k, l;
 	nvmlDevice_t *devList;
-	char buf[MBUF_SZ];
+	nvmlPciInfo_t pci;
+	char buf[MBUF_SZ], *visible;
 	size_t bytes;
 
 	// Counts all devices, even those NVML has no permission to talk to.
@@ -283,7 +425,13 @@ getDevices(gpu_t *gpuList[]) {
 	}
 
 	PROM_DEBUG("devList = %p", devList);
+	visible = getVisibleDevices(devs);
 	for (i = 0; i < devs; i++) {
+		if (visible != NULL && visible[i] == 0) {
+			PROM_DEBUG("gpu[%u] is not visible - skipped", i);
+			devList[i] = NULL;
+			continue;
+		}
 		res = nvmlDeviceGetHandleByIndex_v2(i, &(devList[i]));
 		if (NVML_SUCCESS != res) { 
 			PROM_WARN("Failed to get device handle %u: %s", i, nverror(res));
@@ -298,8 +446,10 @@ getDevices(gpu_t *gpuList[]) {
 
 	bytes = sizeof(gpu_t) * count;
 	*gpuList = malloc(bytes);
-	if (*gpuList == NULL)
+	if (*gpuList == NULL) {
+		count = 0;
 		goto end;
+	}
 	memset(*gpuList, 0, bytes);
 	PROM_DEBUG("gpuList = %p", *gpuList);
 
@@ -310,55 +460,105 @@ getDevices(gpu_t *gpuList[]) {
 		PROM_DEBUG("gpu[%u] = %p", i, &((*gpuList)[i]));
 		(*gpuList)[k].dev = devList[i];
 		(*gpuList)[k].idx = i;
+		// in case initTopology() cannot resolve them
+		for (l = 0; l < NVML_NVLINK_MAX_LINKS; l++)
+			(*gpuList)[k].nvLinkPeer[l] = NVLINK_PEER_UNKNOWN;
 		res = nvmlDeviceGetUUID((*gpuList)[k].dev, buf, MBUF_SZ);
 		if (NVML_SUCCESS != res) {
 			PROM_WARN("Failed to get UUID dev %u: %s", i, nverror(res));
 		} else {
 			(*gpuList)[k].uuid = strdup(buf + 4);	// now it is a propper UUID
 		}
+		res = nvmlDeviceGetPciInfo((*gpuList)[k].dev, &pci);
+		if (NVML_SUCCESS != res) {
+			PROM_WARN("Failed to get pciInfo dev %u: %s", i, nverror(res));
+		} else {
+			// same notation as used by the kernel, e.g. 0000:3b:00.0
+			snprintf(buf, sizeof(buf), "%04x:%02x:%02x.0",
+				pci.domain, pci.bus, pci.device);
+			(*gpuList)[k].pciId = strdup(buf);
+		}
+		enumMig(&((*gpuList)[k]));
 		k++;
 	}
+	initTopology(count, *gpuList);
 
 end:
+	free(visible);
 	free(devList);
 	devList = NULL;
 
-	return devs;
+	// the size of gpuList - inaccessible or invisible GPUs are not in there
+	return count;
 }
 
-uint
-cleanup(uint devs, gpu_t *devList[]) {
+void
+resetStatic(uint devs, gpu_t devList[]) {
 	uint i, k;
+	gpu_t *gpu;
 
 	free(versionHR);
 	versionHR = NULL;
 	free(versionProm);
 	versionProm = NULL;
+
+	if (devList == NULL)
+		return;
+
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		free(gpu->info);
+		gpu->info = NULL;
+		if (gpu->minMaxClock != NULL) {
+			for (k = 0; k < NVML_CLOCK_COUNT; k++)
+				free(gpu->minMaxClock[k]);
+			free(gpu->minMaxClock);
+			gpu->minMaxClock = NULL;
+		}
+		if (gpu->defaultClock != NULL) {
+			for (k = 0; k < NVML_CLOCK_COUNT; k++)
+				free(gpu->defaultClock[k]);
+			free(gpu->defaultClock);
+			gpu->defaultClock = NULL;
+		}
+		free(gpu->temperatures);
+		gpu->temperatures = NULL;
+		free(gpu->powerlimits);
+		gpu->powerlimits = NULL;
+		free(gpu->pcieLinkInfo);
+		gpu->pcieLinkInfo = NULL;
+		free(gpu->nvLinkBW);
+		gpu->nvLinkBW = NULL;
+		free(gpu->nvLinkCount);
+		gpu->nvLinkCount = NULL;
+		// instances may have been created or destroyed meanwhile
+		freeMig(gpu);
+	}
+}
+
+uint
+cleanup(uint devs, gpu_t *devList[]) {
+	uint i;
+
+	resetStatic(devs, *devList);
 	free(gpuInfoHR);
 	gpuInfoHR = NULL;
 
 	if (*devList == NULL || devs == 0)
 		return 0;
 
+	freeTopology();
 	for (i = 0; i < devs; i++) {
 		free((*devList)[i].uuid);
 		free((*devList)[i].pciId);
-		free((*devList)[i].info);
-		if ((*devList)[i].minMaxClock != NULL) {
-			for (k = 0; k < NVML_CLOCK_COUNT; k++)
-				free((*devList)[i].minMaxClock[k]);
-			free((*devList)[i].minMaxClock);
-		}
-		if ((*devList)[i].defaultClock != NULL) {
-			for (k = 0; k < NVML_CLOCK_COUNT; k++)
-				free((*devList)[i].defaultClock[k]);
-			free((*devList)[i].defaultClock);
-		}
-		free((*devList)[i].temperatures);
-		free((*devList)[i].powerlimits);
-		free((*devList)[i].pcieLinkInfo);
-		free((*devList)[i].nvLinkBW);
-		free((*devList)[i].nvLinkCount);
+		rcFree(&((*devList)[i]));
+		closePCIeHealth(&((*devList)[i]));
+		freeSamples(&((*devList)[i]));
+		freeEnergy(&((*devList)[i]));
+		freeVgpu(&((*devList)[i]));
+		freeDcgm(&((*devList)[i]));
+		freeECC(&((*devList)[i]));
+		rtFree(&((*devList)[i]));
 		(*devList)[i].dev = NULL;
 	}
 	free(*devList);
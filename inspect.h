@@ -49,9 +49,11 @@ char *getVersions(psb_t *report, bool compact);
 char *getDevInfos(psb_t *report, bool compact, uint devs, gpu_t devList[]);
 
 /**
- * Get a list of all accessible devices. If a device is not accessible, the
- * corresponding entry in the list is \c NULL. Entries in the list have the
- * same index as the NVML device index (and usually ordered by pci address).
+ * Get a list of all accessible devices. Devices, which are not accessible or
+ * not visible according to the environment variable NVIDIA_VISIBLE_DEVICES
+ * (or if unset CUDA_VISIBLE_DEVICES), are not in the list, and no handle gets
+ * obtained for them. The entries are ordered by NVML device index (and thus
+ * usually ordered by pci address). \c gpu_t.idx is the NVML device index.
  *
  * @param devList	where to store the pointer to the generated device list.
  * @return the number of available device, the size of \c devList .
@@ -60,6 +62,15 @@ uint getDevices(gpu_t *devList[]);
 
 uint getUnitInfos(psb_t *sb);
 
+/**
+ * Drop all cached static metrics (version, GPU info, clock, temperature,
+ * power, PCIe and NvLink) so that they get probed again on the next
+ * collection.
+ * @param devs	number of devices in \c devList.
+ * @param devList	the device list obtained via \c getDevices() .
+ */
+void resetStatic(uint devs, gpu_t devList[]);
+
 /**
  * Cleanup the list of gpu devices obtained via \c getDevices() to avoid
  * memory leaks.
@@ -0,0 +1,160 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kmsg.h"
+#include "events.h"
+
+// a /dev/kmsg record has 1 KiB at most, so this is plenty
+#define KBUF_SZ 8192
+
+// NVRM: Xid (PCI:0000:3b:00): 79, pid=..., GPU has fallen off the bus.
+#define XID_TAG "NVRM: Xid (PCI:"
+
+static struct {
+	int		fd;
+	uint	devs;
+	gpu_t	*devList;
+	size_t	len;		//!< bytes of an incomplete line in buf
+	char	buf[KBUF_SZ];
+} km = { .fd = -1, .len = 0 };
+
+uint
+startKmsg(const char *path, uint devs, gpu_t devList[]) {
+	uint i;
+
+	if (km.fd >= 0 || devs == 0)
+		return 1;
+	if (path == NULL)
+		path = KMSG_PATH;
+
+	for (i = 0; i < devs; i++) {
+		if ((devList[i].events & nvmlEventTypeXidCriticalError) == 0)
+			break;
+	}
+	if (i == devs) {
+		PROM_DEBUG("All GPUs report Xid events - %s not needed", path);
+		return 0;
+	}
+
+	km.fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (km.fd < 0) {
+		PROM_INFO("Unable to open '%s': %s - Xid errors not available",
+			path, strerror(errno));
+		return 1;
+	}
+	// skip all messages logged so far
+	if (lseek(km.fd, 0, SEEK_END) == (off_t) -1)
+		PROM_WARN("Unable to skip old messages in '%s': %s", path,
+			strerror(errno));
+	km.devs = devs;
+	km.devList = devList;
+	km.len = 0;
+	PROM_DEBUG("Following '%s' for Xid errors", path);
+	return 0;
+}
+
+static void
+parseLine(char *line) {
+	char *s, *e, id[16];
+	unsigned long domain, bus, dev, xid;
+	gpu_t *gpu;
+	uint i;
+
+	s = strstr(line, XID_TAG);
+	if (s == NULL)
+		return;
+	s += sizeof(XID_TAG) - 1;
+
+	// the kernel omits the function: [domain:]bus:device
+	domain = strtoul(s, &e, 16);
+	if (*e != ':')
+		return;
+	bus = strtoul(e + 1, &e, 16);
+	if (*e == ':') {
+		dev = strtoul(e + 1, &e, 16);
+	} else {
+		dev = bus;
+		bus = domain;
+		domain = 0;
+	}
+	if (strncmp(e, "): ", 3) != 0)
+		return;
+	xid = strtoul(e + 3, &s, 10);
+	if (s == e + 3)
+		return;
+
+	snprintf(id, sizeof(id), "%04lx:%02lx:%02lx.", domain, bus, dev);
+	for (i = 0; i < km.devs; i++) {
+		gpu = &(km.devList[i]);
+		if (gpu->pciId == NULL || strncmp(gpu->pciId, id, strlen(id)) != 0)
+			continue;
+		// do not count twice
+		if ((gpu->events & nvmlEventTypeXidCriticalError) == 0) {
+			PROM_DEBUG("GPU %u: Xid %lu", gpu->idx, xid);
+			countXid(gpu, xid);
+		}
+		return;
+	}
+	PROM_DEBUG("Xid %lu of unknown GPU %s ignored", xid, id);
+}
+
+void
+readKmsg(void) {
+	ssize_t n;
+	char *s, *e;
+
+	if (km.fd < 0)
+		return;
+
+	for (;;) {
+		n = read(km.fd, km.buf + km.len, sizeof(km.buf) - 1 - km.len);
+		if (n < 0) {
+			// EPIPE: messages got overwritten, continue with the next one
+			if (errno == EINTR || errno == EPIPE)
+				continue;
+			if (errno != EAGAIN)
+				PROM_WARN("Reading kernel messages failed: %s",
+					strerror(errno));
+			return;
+		}
+		if (n == 0)		// EOF of a plain file
+			return;
+		km.len += n;
+		km.buf[km.len] = '\0';
+		for (s = km.buf; (e = strchr(s, '\n')) != NULL; s = e + 1) {
+			*e = '\0';
+			parseLine(s);
+		}
+		km.len -= s - km.buf;
+		if (km.len == sizeof(km.buf) - 1) {
+			// line too long - drop it
+			km.len = 0;
+		} else if (km.len > 0 && s != km.buf) {
+			memmove(km.buf, s, km.len);
+		}
+	}
+}
+
+void
+stopKmsg(void) {
+	if (km.fd >= 0) {
+		close(km.fd);
+		km.fd = -1;
+	}
+	km.len = 0;
+}
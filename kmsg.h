@@ -0,0 +1,58 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file kmsg.h
+ * Follow the kernel message buffer and count NVRM Xid errors of GPUs, for
+ * which no NVML Xid events are available.
+ */
+
+#ifndef NVMEX_KMSG_H
+#define NVMEX_KMSG_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The default kernel message device to follow. */
+#define KMSG_PATH	"/dev/kmsg"
+
+/**
+ * Open the given kernel message device or file and skip all messages
+ * already in there. Nothing gets opened, if all devices report Xid errors
+ * via NVML events (see \c startEvents() ).
+ * @param path	the device or file to follow. If \c NULL , \c KMSG_PATH
+ *	gets used.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices, whose Xid errors should be counted. Must
+ *	not be \c NULL and must stay valid until \c stopKmsg() got called!
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+uint startKmsg(const char *path, uint devs, gpu_t devList[]);
+
+/**
+ * Read all kernel messages arrived since the last call and count the Xid
+ * errors found (see \c countXid() ). Never blocks.
+ */
+void readKmsg(void);
+
+/**
+ * Close the kernel message device or file opened via \c startKmsg() .
+ */
+void stopKmsg(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_KMSG_H
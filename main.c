@@ -25,21 +25,18 @@
 #include <microhttpd.h>
 
 #include "inspect.h"
-#include "clocks.h"
-#include "bar1memory.h"
-#include "temperature.h"
-#include "power.h"
-#include "fan.h"
-#include "util.h"
+#include "modules.h"
+#include "rcache.h"
+#include "events.h"
+#include "kmsg.h"
+#include "pcihealth.h"
 #include "pcie.h"
-#include "violations.h"
-#include "memory.h"
+#include "power.h"
+#include "gpm.h"
+#include "dcgm.h"
+#include "topo.h"
 #include "ecc.h"
-#include "nvlink.h"
-#include "enc.h"
-#ifndef LEGACY
-#include "fbc.h"
-#endif
+#include "throttle.h"
 
 typedef enum {
 	SMF_EXIT_OK	= 0,
@@ -57,44 +54,33 @@ typedef enum {
 static struct option options[] = {
 	{"no-scrapetime",		no_argument,		NULL, 'L'},
 	{"no-scrapetime-all",	no_argument,		NULL, 'S'},
+	{"power-sampling",		required_argument,	NULL, 'P'},
+	{"power-threshold",		required_argument,	NULL, 'T'},
+	{"fields",				required_argument,	NULL, 'F'},
+	{"ecc-nonzero",			no_argument,		NULL, 'E'},
+	{"throttle-sampling",	required_argument,	NULL, 't'},
 	{"compact",				no_argument,		NULL, 'c'},
 	{"daemon",				no_argument,		NULL, 'd'},
 	{"foreground",			no_argument,		NULL, 'f'},
 	{"help",				no_argument,		NULL, 'h'},
+	{"kmsg",				required_argument,	NULL, 'k'},
 	{"logfile",				required_argument,	NULL, 'l'},
 	{"no-metrics",			required_argument,	NULL, 'n'},
 	{"port",				required_argument,	NULL, 'p'},
+	{"refresh",				required_argument,	NULL, 'r'},
 	{"source",				required_argument,	NULL, 's'},
 	{"verbosity",			required_argument,	NULL, 'v'},
 	{"version",				no_argument,		NULL, 'V'},
+	{"sysfs",				required_argument,	NULL, 'y'},
 	{0, 0, 0, 0}
 };
 
 static const char *shortUsage = {
-	"[-LScdfh] [-l file] [-n list] [-s ip] [-p port] [-v DEBUG|INFO|WARN|ERROR|FATAL]"
+	"[-ELScdfh] [-F file] [-P hz] [-T mW|pct%] [-k file] [-l file] [-n list] [-r list] [-s ip] [-t hz] [-p port] [-y dir] [-v DEBUG|INFO|WARN|ERROR|FATAL]"
 };
 
 static struct {
 	uint promflags;
-	bool versionInfo;
-	bool gpuInfo;
-	bool clocks;
-	bool bar1mem;
-	bool temperature;
-	bool power;
-	bool fan;
-	bool util;
-	bool pcie;
-	bool violations;
-	bool memory;
-	bool ecc;
-	bool nvlink;
-	bool encStats;
-	bool encSessions;
-#ifndef LEGACY
-	bool fbcStats;
-	bool fbcSessions;
-#endif
 	gpu_t *devList;
 	unsigned int devs;
 	prom_counter_t *req_counter;
@@ -105,27 +91,9 @@ static struct {
 	bool ipv6;
 	int MHD_error;
 	char *logfile;
+	char *kmsg;
 } global = {
 	.promflags = PROM_PROCESS | PROM_SCRAPETIME | PROM_SCRAPETIME_ALL,
-	.versionInfo = true,
-	.gpuInfo = true,
-	.clocks = true,
-	.bar1mem = true,
-	.temperature = true,
-	.power = true,
-	.fan = true,
-	.util = true,
-	.pcie = true,
-	.violations = true,
-	.memory = true,
-	.ecc = true,
-	.nvlink = true,
-	.encStats = true,
-	.encSessions = true,
-#ifndef LEGACY
-	.fbcStats = true,
-	.fbcSessions = true,
-#endif
 	.devList = NULL,
 	.devs = 0,
 	.req_counter = NULL,
@@ -135,7 +103,8 @@ static struct {
 	.addr = NULL,
 	.ipv6 = false,
 	.MHD_error = -1,
-	.logfile = NULL
+	.logfile = NULL,
+	.kmsg = NULL
 };
 
 static int
@@ -166,46 +135,13 @@ disableMetrics(char *skipList) {
 		if (s != e) {
 			if (strcmp(s, "process") == 0)
 				global.promflags &= ~PROM_PROCESS;
-			else if (strcmp(s, "version") == 0)
-				global.versionInfo = false;
-			else if (strcmp(s, "gpuinfo") == 0)
-				global.gpuInfo = false;
-			else if (strcmp(s, "clock") == 0)
-				global.clocks = false;
-			else if (strcmp(s, "bar1mem") == 0)
-				global.bar1mem = false;
-			else if (strcmp(s, "temperature") == 0)
-				global.temperature = false;
-			else if (strcmp(s, "power") == 0)
-				global.power = false;
-			else if (strcmp(s, "fan") == 0)
-				global.fan = false;
-			else if (strcmp(s, "utilization") == 0)
-				global.util = false;
-			else if (strcmp(s, "pcie") == 0)
-				global.pcie = false;
-			else if (strcmp(s, "violation") == 0)
-				global.violations = false;
-			else if (strcmp(s, "memory") == 0)
-				global.memory = false;
-			else if (strcmp(s, "ecc") == 0)
-				global.ecc = false;
-			else if (strcmp(s, "nvlink") == 0)
-				global.nvlink = false;
-			else if (strcmp(s, "encstat") == 0)
-				global.encStats = false;
-			else if (strcmp(s, "encsession") == 0)
-				global.encSessions = false;
-#ifndef LEGACY
-			else if (strcmp(s, "fbcstat") == 0)
-				global.fbcStats = false;
-			else if (strcmp(s, "fbcsession") == 0)
-				global.fbcSessions = false;
-#else
+			else if (strcmp(s, "static") == 0)
+				skipStatic = true;
+#ifdef LEGACY
 			else if (strcmp(s, "fbcstat") == 0 || strcmp(s, "fbcsession") == 0)
 				PROM_WARN("Legacy metrics '%s' ignored", s);
 #endif
-			else {
+			else if (modEnable(s, false) != 0) {
 				PROM_WARN("Unknown metrics '%s'", s);
 				res++;
 			}
@@ -221,43 +157,115 @@ disableMetrics(char *skipList) {
 
 // Just in case, someone switches to MHD_USE_THREAD_PER_CONNECTION
 static _Thread_local psb_t *sb = NULL;
+// modules requested via URL for the current request
+static _Thread_local unsigned long long selected = MOD_ALL;
+// GPUs requested via URL for the current request, NULL for all
+static _Thread_local char *selectedGPUs = NULL;
+
+/*
+ * Check, whether the label set of the given metric line denotes a GPU.
+ * Returns -1 if not, 0 if the GPU is not selected in selectedGPUs, 1
+ * otherwise. A gpu label gets used if present, a uuid, UUID or uid label
+ * (with or without GPU- prefix) else. Only real label names count, i.e.
+ * vgpu_uuid="..." et al. are not a GPU label.
+ */
+static int
+isSelected(const char *s) {
+	const char *k, *v, *e, *uuid = NULL;
+	size_t ulen = 0;
+	char *end;
+	uint i, n;
+
+	s = strchr(s, '{');
+	if (s == NULL)
+		return -1;
+	for (k = s + 1; *k != '}' && *k != '\0'; k = (*e == ',') ? e + 1 : e) {
+		v = strchr(k, '=');
+		if (v == NULL || v[1] != '"')
+			return -1;
+		v += 2;
+		for (e = v; *e != '"' && *e != '\0'; e++) {
+			if (*e == '\\' && e[1] != '\0')
+				e++;
+		}
+		if (*e == '\0')
+			return -1;
+		if (v - k == 5 && strncmp(k, "gpu", 3) == 0) {
+			n = strtoul(v, &end, 10);
+			if (end != e || end == v)
+				return -1;
+			for (i = 0; i < global.devs; i++) {
+				if (global.devList[i].idx == n)
+					return selectedGPUs[i];
+			}
+			return 0;
+		}
+		if ((v - k == 6 && (strncmp(k, "uuid", 4) == 0
+				|| strncmp(k, "UUID", 4) == 0))
+			|| (v - k == 5 && strncmp(k, "uid", 3) == 0))
+		{
+			uuid = v;
+			ulen = e - v;
+		}
+		e++;
+	}
+	if (uuid == NULL)
+		return -1;
+	if (ulen > 4 && strncmp(uuid, "GPU-", 4) == 0) {
+		uuid += 4;
+		ulen -= 4;
+	}
+	for (i = 0; i < global.devs; i++) {
+		if (global.devList[i].uuid != NULL
+			&& strncmp(global.devList[i].uuid, uuid, ulen) == 0
+			&& global.devList[i].uuid[ulen] == '\0')
+		{
+			return selectedGPUs[i];
+		}
+	}
+	return 0;
+}
+
+/*
+ * Copy all lines of str to sb, except metrics of GPUs not selected in
+ * selectedGPUs. Metrics without a GPU label get always copied.
+ */
+static void
+filterGPUs(psb_t *dst, char *str) {
+	char *s, *e;
+
+	for (s = str; *s != '\0'; s = e) {
+		e = strchr(s, '\n');
+		if (e == NULL)
+			e = s + strlen(s);
+		else
+			*e++ = '\0';
+		if (*s == '#' || isSelected(s) != 0) {
+			psb_add_str(dst, s);
+			psb_add_char(dst, '\n');
+		}
+	}
+}
 
 static prom_map_t *
 collect(prom_collector_t *self) {
 	bool compact = global.promflags & PROM_COMPACT;
+	psb_t *gsb = sb;
+
 	PROM_DEBUG("collector: %p  sb: %p", self, sb);
-	if (global.versionInfo)
-		getVersions(sb, compact);
-	if (global.gpuInfo)
-		getDevInfos(sb, compact, global.devs, global.devList);
-	if (global.clocks)
-		getClocks(sb, compact, global.devs, global.devList);
-	if (global.bar1mem)
-		getBar1memory(sb, compact, global.devs, global.devList);
-	if (global.temperature)
-		getTemperatures(sb, compact, global.devs, global.devList);
-	if (global.power)
-		getPower(sb, compact, global.devs, global.devList);
-	if (global.fan)
-		getFan(sb, compact, global.devs, global.devList);
-	if (global.util)
-		getUtilization(sb, compact, global.devs, global.devList);
-	if (global.pcie)
-		getPCIe(sb, compact, global.devs, global.devList);
-	if (global.violations)
-		getViolations(sb, compact, global.devs, global.devList);
-	if (global.memory)
-		getMemory(sb, compact, global.devs, global.devList);
-	if (global.ecc)
-		getECC(sb, compact, global.devs, global.devList);
-	if (global.nvlink)
-		getNvLink(sb, compact, global.devs, global.devList);
-	if (global.encStats || global.encSessions)
-		getEnc(sb, compact, global.devs, global.devList, global.encSessions);
-#ifndef LEGACY
-	if (global.fbcStats || global.fbcSessions)
-		getFBC(sb, compact, global.devs, global.devList, global.fbcSessions);
-#endif
+	if (sb != NULL && selectedGPUs != NULL) {
+		gsb = psb_new();
+		if (gsb == NULL)
+			return NULL;
+	}
+	modCollect(gsb, compact, global.devs, global.devList, selected);
+	if (gsb != sb) {
+		filterGPUs(sb, psb_str(gsb));
+		psb_destroy(gsb);
+	}
+	// exporter internals belong to the full scrape, only
+	if (sb != NULL && selected == MOD_ALL && selectedGPUs == NULL)
+		rcGetStats(sb, compact);
 	if (sb != NULL && !compact)
 		psb_add_char(sb, '\n');
 	return NULL;
@@ -285,6 +293,78 @@ getShortOpts(const struct option *opts) {
 	return str;
 }
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+// collect the module names of all collect[] and the GPUs of all gpu URL
+// query arguments
+#if MHD_VERSION >= 0x00097002
+static enum MHD_Result
+#else
+static int
+#endif
+select_handler(void *cls, enum MHD_ValueKind kind, const char *key,
+	const char *value)
+{
+#pragma GCC diagnostic pop
+	int *err = cls;
+	char *end;
+	uint i, n;
+
+	if (value == NULL)
+		value = "";
+	if (strcmp(key, "collect[]") == 0) {
+		if (modSelect(value, strlen(value), &selected) != 0) {
+			PROM_DEBUG("Invalid module '%s' requested", value);
+			(*err)++;
+		}
+	} else if (strcmp(key, "gpu") == 0) {
+		if (selectedGPUs == NULL) {
+			selectedGPUs = calloc(global.devs, sizeof(char));
+			if (selectedGPUs == NULL) {
+				(*err)++;
+				return MHD_NO;
+			}
+		}
+		n = strtoul(value, &end, 10);
+		if (*end != '\0' || end == value)
+			n = -1;
+		if (strncmp(value, "GPU-", 4) == 0)
+			value += 4;
+		for (i = 0; i < global.devs; i++) {
+			if (global.devList[i].idx == n || (global.devList[i].uuid != NULL
+				&& strcmp(global.devList[i].uuid, value) == 0))
+			{
+				selectedGPUs[i] = 1;
+				break;
+			}
+		}
+		if (i == global.devs) {
+			PROM_DEBUG("Invalid GPU '%s' requested", value);
+			(*err)++;
+		}
+	}
+	return MHD_YES;
+}
+
+// set the modules and GPUs to collect for the given /metrics* URL
+static int
+selectMetrics(struct MHD_Connection *connection, const char *url) {
+	int err = 0;
+
+	selected = 0;
+	if (url[8] == '/')
+		err = modSelect(url + 9, strlen(url + 9), &selected);
+	MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND,
+		&select_handler, &err);
+	if (err != 0 || selected == 0)
+		selected = MOD_ALL;
+	if (err != 0) {
+		free(selectedGPUs);
+		selectedGPUs = NULL;
+	}
+	return err;
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #if MHD_VERSION >= 0x00097002
@@ -298,13 +378,14 @@ http_handler(void *cls, struct MHD_Connection *connection, const char *url,
 {
 #pragma GCC diagnostic pop
 	char *body, *s;
+	const char *etag = NULL, *match, *ctype = NULL;
 	size_t len;
 	struct MHD_Response *response;
 	enum MHD_ResponseMemoryMode mode = MHD_RESPMEM_PERSISTENT;
 	unsigned int status = MHD_HTTP_BAD_REQUEST;
 	static const char *labels[] = { "" };
-	static char *RESP[] = { NULL, NULL, NULL };
-	static int rlen[] = { 0, 0, 0 };
+	static char *RESP[] = { NULL, NULL, NULL, NULL };
+	static int rlen[] = { 0, 0, 0, 0 };
 
 	int ret;
 
@@ -315,6 +396,8 @@ http_handler(void *cls, struct MHD_Connection *connection, const char *url,
 		rlen[1] = strlen(RESP[1]);
 		RESP[2]= strdup("Bad Request\n");
 		rlen[2] = strlen(RESP[2]);
+		RESP[3]= strdup("Internal Server Error\n");
+		rlen[3] = strlen(RESP[3]);
 	}
 
 	if (strcmp(method, "GET") != 0) {
@@ -326,7 +409,47 @@ http_handler(void *cls, struct MHD_Connection *connection, const char *url,
 		len = rlen[1];
 		status = MHD_HTTP_OK;
 		labels[0] = "/";
-	} else if (strcmp(url, "/metrics") == 0) {
+	} else if (strcmp(url, "/metrics/static") == 0) {
+		labels[0] = "/metrics/static";
+		body = modStatic(global.promflags & PROM_COMPACT,
+			global.devs, global.devList, &etag);
+		if (body == NULL) {
+			body = RESP[3];
+			len = rlen[3];
+			etag = NULL;
+			status = MHD_HTTP_INTERNAL_SERVER_ERROR;
+		} else {
+			match = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+				MHD_HTTP_HEADER_IF_NONE_MATCH);
+			if (match != NULL
+				&& (strcmp(match, "*") == 0 || strstr(match, etag) != NULL))
+			{
+				len = 0;
+				status = MHD_HTTP_NOT_MODIFIED;
+			} else {
+				len = strlen(body);
+				status = MHD_HTTP_OK;
+			}
+			// a re-probe on another connection may free it meanwhile
+			mode = MHD_RESPMEM_MUST_COPY;
+		}
+	} else if (strcmp(url, "/topology") == 0) {
+		labels[0] = "/topology";
+		body = getTopologyJSON();
+		if (body == NULL) {
+			body = RESP[3];
+			len = rlen[3];
+			status = MHD_HTTP_INTERNAL_SERVER_ERROR;
+		} else {
+			len = strlen(body);
+			status = MHD_HTTP_OK;
+			ctype = "application/json";
+			mode = MHD_RESPMEM_MUST_COPY;
+		}
+	} else if (strncmp(url, "/metrics", 8) == 0
+		&& (url[8] == '\0' || url[8] == '/')
+		&& selectMetrics(connection, url) == 0)
+	{
 		// trick 17: collect() adds stuff to sb directly, when it gets invoked
 		// indirectly by pcr_bridge(). Therefore: thread local
 		if (sb != NULL)
@@ -339,6 +462,9 @@ http_handler(void *cls, struct MHD_Connection *connection, const char *url,
 		len = psb_len(sb);
 		psb_destroy(sb);		// avoid mem leaks on thread exit
 		sb = NULL;
+		selected = MOD_ALL;
+		free(selectedGPUs);
+		selectedGPUs = NULL;
 		labels[0] = "/metrics";
 		mode = MHD_RESPMEM_MUST_FREE;
 		status = MHD_HTTP_OK;
@@ -355,6 +481,11 @@ http_handler(void *cls, struct MHD_Connection *connection, const char *url,
 			free(body);
 		ret = MHD_NO;
 	} else {
+		if (etag != NULL)
+			MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag);
+		if (ctype != NULL)
+			MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE,
+				ctype);
 		labels[0] = "count";
 		prom_counter_inc(global.res_counter, labels);
 		labels[0] = "bytes";
@@ -588,6 +719,21 @@ main(int argc, char **argv) {
 			case 'S':
 				global.promflags &= ~PROM_SCRAPETIME_ALL;
 				break;
+			case 'P':
+				err += setPowerSampling(optarg);
+				break;
+			case 'T':
+				err += setPowerThreshold(optarg);
+				break;
+			case 'F':
+				err += setFieldsFile(optarg);
+				break;
+			case 'E':
+				setEccSkipZero(true);
+				break;
+			case 't':
+				err += setThrottleSampling(optarg);
+				break;
 			case 'c':
 				global.promflags |= PROM_COMPACT;
 				break;
@@ -600,6 +746,11 @@ main(int argc, char **argv) {
 			case 'h':
 				fprintf(stderr, "Usage: %s %s\n", argv[0], shortUsage);
 				return 0;
+			case 'k':
+				if (global.kmsg != NULL)
+					free(global.kmsg);
+				global.kmsg = strdup(optarg);
+				break;
 			case 'l':
 				if (global.logfile != NULL)
 					free(global.logfile);
@@ -608,6 +759,9 @@ main(int argc, char **argv) {
 			case 'n':
 				err += disableMetrics(optarg);
 				break;
+			case 'r':
+				err += modSetRefresh(optarg);
+				break;
 			case 'p':
 				if ((sscanf(optarg, "%u", &n) != 1) || n == 0) {
 					fprintf(stderr, "Invalid port '%s'.\n", optarg);
@@ -637,6 +791,9 @@ main(int argc, char **argv) {
 					addr = NULL;
 				}
 				break;
+			case 'y':
+				setSysfsRoot(optarg);
+				break;
 			case 'v':
 				n = prom_log_level_parse(optarg);
 				if (n == 0) {
@@ -693,6 +850,22 @@ main(int argc, char **argv) {
 			status = SMF_EXIT_OK;
 		} else if (setupProm() == 0) {
 			fputs("\n", stderr);
+			if (modEnabled("xid") || modEnabled("ecc") || modEnabled("clock")
+				|| modEnabled("power"))
+			{
+				startEvents(global.devs, global.devList);
+			}
+			modCheckEvents();
+			if (modEnabled("xid"))
+				startKmsg(global.kmsg, global.devs, global.devList);
+			if (modEnabled("pcie"))
+				startPCIeSampler(global.devs, global.devList);
+			if (modEnabled("power"))
+				startPowerSampler(global.devs, global.devList);
+			if (modEnabled("gpm"))
+				startGpm(global.devs, global.devList);
+			if (modEnabled("throttle"))
+				startThrottleSampler(global.devs, global.devList);
 			status = startHttpServer();
 			// let the parent exit
 			if (mode == 2) {
@@ -719,8 +892,18 @@ main(int argc, char **argv) {
 	}
 	// finally
 	psb_destroy(buf);
+	stopThrottleSampler();
+	stopGpm();
+	stopPowerSampler();
+	stopPCIeSampler();
+	stopKmsg();
+	stopEvents();
 	cleanupProm();
+	modCleanup();
 	free(global.addr);
+	free(global.kmsg);
+	setSysfsRoot(NULL);
+	setFieldsFile(NULL);
 	global.devs = cleanup(global.devs, &global.devList);
 	stop();
 	return status;
@@ -40,13 +40,13 @@ getMemory(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		if (NVML_SUCCESS == res) {
 			len = snprintf(buf, sizeof(buf),
 				NVMEXM_MEM_N "{gpu=\"%d\",value=\"total\",uuid=\"%s\"} %llu\n",
-				i, gpu->uuid, memory.total);
+				gpu->idx, gpu->uuid, memory.total);
 			len += snprintf(buf + len , sizeof(buf) - len,
 				NVMEXM_MEM_N "{gpu=\"%d\",value=\"free\",uuid=\"%s\"} %llu\n",
-				i, gpu->uuid, memory.free);
+				gpu->idx, gpu->uuid, memory.free);
 			len += snprintf(buf + len, sizeof(buf) - len,
 				NVMEXM_MEM_N "{gpu=\"%d\",value=\"used\",uuid=\"%s\"} %llu\n",
-				i, gpu->uuid, memory.used);
+				gpu->idx, gpu->uuid, memory.used);
 			psb_add_str(sb, buf);
 		}
 	}
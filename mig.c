@@ -0,0 +1,183 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mig.h"
+
+void
+freeMig(gpu_t *gpu) {
+	uint i;
+
+	for (i = 0; i < gpu->migs; i++)
+		free(gpu->mig[i].uuid);
+	free(gpu->mig);
+	gpu->mig = NULL;
+	gpu->migs = 0;
+}
+
+#ifdef NVML_DEVICE_MIG_ENABLE
+uint
+enumMig(gpu_t *gpu) {
+	nvmlReturn_t res;
+	nvmlDevice_t dev;
+	uint i, max, mode, pending;
+	char buf[MBUF_SZ];
+	mig_t *m;
+
+	freeMig(gpu);
+	if (gpu->dev == NULL || gpu->hasMig == -1)
+		return 0;
+	res = nvmlDeviceGetMigMode(gpu->dev, &mode, &pending);
+	if (NOT_AVAIL(res)) {
+		PROM_DEBUG("gpu.hasMig = -1", "");
+		gpu->hasMig = -1;
+		return 0;
+	}
+	// may be enabled later (requires a GPU reset)
+	if (NVML_SUCCESS != res || mode != NVML_DEVICE_MIG_ENABLE)
+		return 0;
+	res = nvmlDeviceGetMaxMigDeviceCount(gpu->dev, &max);
+	if (NVML_SUCCESS != res || max == 0)
+		return 0;
+	gpu->mig = calloc(max, sizeof(mig_t));
+	if (gpu->mig == NULL)
+		return 0;
+	for (i = 0; i < max; i++) {
+		// unused slots report NVML_ERROR_NOT_FOUND
+		res = nvmlDeviceGetMigDeviceHandleByIndex(gpu->dev, i, &dev);
+		if (NVML_SUCCESS != res)
+			continue;
+		m = &(gpu->mig[gpu->migs]);
+		m->dev = dev;
+		m->idx = i;
+		if (nvmlDeviceGetGpuInstanceId(dev, &(m->gi)) != NVML_SUCCESS
+			|| nvmlDeviceGetComputeInstanceId(dev, &(m->ci)) != NVML_SUCCESS)
+		{
+			PROM_DEBUG("GPU %u: MIG device %u has no instance IDs",
+				gpu->idx, i);
+			continue;
+		}
+		res = nvmlDeviceGetUUID(dev, buf, sizeof(buf));
+		m->uuid = strdup(NVML_SUCCESS == res ? buf : "");
+		gpu->migs++;
+	}
+	gpu->hasMig = 1;
+	PROM_DEBUG("GPU %u: %u MIG devices", gpu->idx, gpu->migs);
+	return gpu->migs;
+}
+
+bool
+getMig(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	nvmlReturn_t res;
+	nvmlMemory_t memory;
+	gpu_t *gpu;
+	mig_t *m;
+	size_t sz;
+	uint i, k, n;
+	char buf[MBUF_SZ];
+	bool free_sb = sb == NULL;
+	psb_t *sbm, *sbp;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getMig", "");
+	sbm = psb_new();
+	sbp = psb_new();
+	if (sbm == NULL || sbp == NULL) {
+		psb_destroy(sbm);
+		psb_destroy(sbp);
+		return false;
+	}
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_MIG_INFO);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasMig == -1)
+			continue;
+		if (gpu->mig == NULL && enumMig(gpu) == 0)
+			continue;
+		for (k = 0; k < gpu->migs; k++) {
+			m = &(gpu->mig[k]);
+			snprintf(buf, sizeof(buf), NVMEXM_MIG_INFO_N
+				"{gpu=\"%d\",gi=\"%u\",ci=\"%u\",mig=\"%s\",uuid=\"%s\"} 1\n",
+				gpu->idx, m->gi, m->ci, m->uuid, gpu->uuid);
+			psb_add_str(sb, buf);
+
+			res = nvmlDeviceGetMemoryInfo(m->dev, &memory);
+			if (NVML_SUCCESS != res && !NOT_AVAIL(res)) {
+				// instance destroyed: enumerate again next time
+				PROM_DEBUG("GPU %u: MIG device %u gone: %s", gpu->idx,
+					m->idx, nverror(res));
+				freeMig(gpu);
+				break;
+			}
+			if (NVML_SUCCESS == res) {
+				snprintf(buf, sizeof(buf), NVMEXM_MIG_MEM_N
+					"{gpu=\"%d\",gi=\"%u\",ci=\"%u\",value=\"total\",uuid=\"%s\"}"
+					" %llu\n", gpu->idx, m->gi, m->ci, gpu->uuid, memory.total);
+				psb_add_str(sbm, buf);
+				snprintf(buf, sizeof(buf), NVMEXM_MIG_MEM_N
+					"{gpu=\"%d\",gi=\"%u\",ci=\"%u\",value=\"used\",uuid=\"%s\"}"
+					" %llu\n", gpu->idx, m->gi, m->ci, gpu->uuid, memory.used);
+				psb_add_str(sbm, buf);
+			}
+
+			// just the count
+			n = 0;
+			res = nvmlDeviceGetComputeRunningProcesses(m->dev, &n, NULL);
+			if (NVML_SUCCESS == res || NVML_ERROR_INSUFFICIENT_SIZE == res) {
+				snprintf(buf, sizeof(buf), NVMEXM_MIG_PROCS_N
+					"{gpu=\"%d\",gi=\"%u\",ci=\"%u\",uuid=\"%s\"} %u\n",
+					gpu->idx, m->gi, m->ci, gpu->uuid, n);
+				psb_add_str(sbp, buf);
+			}
+		}
+	}
+	if (!compact)
+		addPromInfo(NVMEXM_MIG_MEM);
+	psb_add_str(sb, psb_str(sbm));
+	if (!compact)
+		addPromInfo(NVMEXM_MIG_PROCS);
+	psb_add_str(sb, psb_str(sbp));
+	psb_destroy(sbm);
+	psb_destroy(sbp);
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
+#else
+// NVML too old for MIG
+uint
+enumMig(gpu_t *gpu) {
+	gpu->hasMig = -1;
+	return 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+bool
+getMig(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	return false;
+}
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,55 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file mig.h
+ * Enumeration and metrics of MIG (Multi-Instance GPU) devices.
+ */
+
+#ifndef NVMEX_MIG_H
+#define NVMEX_MIG_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Enumerate the MIG devices of the given GPU and store them in
+ * \c gpu->mig . Sets \c gpu->hasMig to \c -1 if MIG is not supported.
+ * @param gpu	the GPU to inspect.
+ * @return the number of MIG devices found.
+ */
+uint enumMig(gpu_t *gpu);
+
+/**
+ * Free the MIG devices of the given GPU. The next collection enumerates
+ * them again.
+ * @param gpu	the GPU whose MIG devices should be freed.
+ */
+void freeMig(gpu_t *gpu);
+
+/**
+ * Get MIG device related metrics.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getMig(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_MIG_H
@@ -0,0 +1,400 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "modules.h"
+#include "inspect.h"
+#include "clocks.h"
+#include "bar1memory.h"
+#include "temperature.h"
+#include "power.h"
+#include "fan.h"
+#include "util.h"
+#include "pcie.h"
+#include "pcihealth.h"
+#include "violations.h"
+#include "memory.h"
+#include "ecc.h"
+#include "nvlink.h"
+#include "events.h"
+#include "kmsg.h"
+#include "procs.h"
+#include "accounting.h"
+#include "mig.h"
+#include "vgpu.h"
+#include "gpm.h"
+#include "throttle.h"
+#include "dcgm.h"
+#include "topo.h"
+#include "enc.h"
+#ifndef LEGACY
+#include "fbc.h"
+#endif
+
+typedef bool (*modfn_t)(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+typedef struct module_st {
+	const char *name;	//!< name as used by option -n and -r
+	modfn_t	fn;			//!< collector, NULL if it is a flag, only
+	bool	enabled;
+	bool	isStatic;	//!< emits static metrics, only
+	int		refresh;	//!< MOD_REFRESH_* or number of seconds
+	time_t	last;		//!< monotonic time of the last collection
+	atomic_bool	dirty;	//!< collect on next scrape, even if not due
+	char	*cache;		//!< prom formatted output of the last collection
+} module_t;
+
+static bool collectVersions(psb_t *sb, bool compact, uint devs,
+	gpu_t devList[]);
+static bool collectDevInfos(psb_t *sb, bool compact, uint devs,
+	gpu_t devList[]);
+static bool collectXid(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+static bool collectEnc(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+#ifndef LEGACY
+static bool collectFBC(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+#endif
+
+#define MODULE(n, f)	{ .name = n, .fn = f, .enabled = true }
+#define STATIC_MODULE(n, f)	{ .name = n, .fn = f, .enabled = true, \
+	.isStatic = true }
+
+// order matters: it is the order metrics appear in the response
+static module_t modules[] = {
+	STATIC_MODULE("version", collectVersions),
+	STATIC_MODULE("gpuinfo", collectDevInfos),
+	STATIC_MODULE("topology", getTopology),
+	MODULE("clock", getClocks),
+	MODULE("bar1mem", getBar1memory),
+	MODULE("temperature", getTemperatures),
+	MODULE("power", getPower),
+	MODULE("fan", getFan),
+	MODULE("utilization", getUtilization),
+	MODULE("gpm", getGpm),
+	MODULE("throttle", getThrottle),
+	MODULE("samples", getSamples),
+	MODULE("pcie", getPCIe),
+	MODULE("pcihealth", getPCIeHealth),
+	MODULE("violation", getViolations),
+	MODULE("memory", getMemory),
+	MODULE("mig", getMig),
+	MODULE("vgpu", getVgpu),
+	MODULE("ecc", getECC),
+	MODULE("xid", collectXid),
+	MODULE("nvlink", getNvLink),
+	MODULE("cgroup", getProcs),
+	MODULE("procutil", getProcUtil),
+	MODULE("accounting", getAccounting),
+	MODULE("dcgm", getDcgm),
+	MODULE("encstat", collectEnc),
+	MODULE("encsession", NULL),
+#ifndef LEGACY
+	MODULE("fbcstat", collectFBC),
+	MODULE("fbcsession", NULL),
+#endif
+};
+
+#define MODULES	(sizeof(modules)/sizeof(module_t))
+
+_Static_assert(MODULES <= sizeof(unsigned long long) * 8,
+	"too many modules for a selection mask");
+
+bool skipStatic = false;
+
+// the prom formatted output of all static metrics
+static struct {
+	int		refresh;	//!< MOD_REFRESH_EVENT or number of seconds
+	time_t	last;		//!< monotonic time of the last probe
+	char	*body;		//!< static metrics
+	char	etag[20];	//!< quoted hash of body
+} statics = { .refresh = 300 };
+
+static module_t *
+findModule(const char *name, size_t len) {
+	uint i;
+
+	for (i = 0; i < MODULES; i++) {
+		if (strncmp(modules[i].name, name, len) == 0
+			&& modules[i].name[len] == '\0')
+		{
+			return &(modules[i]);
+		}
+	}
+	return NULL;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static bool
+collectVersions(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	return getVersions(sb, compact) != NULL;
+}
+#pragma GCC diagnostic pop
+
+static bool
+collectDevInfos(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	return getDevInfos(sb, compact, devs, devList) != NULL;
+}
+
+static bool
+collectXid(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	readKmsg();
+	return getXid(sb, compact, devs, devList);
+}
+
+static bool
+collectEnc(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	return getEnc(sb, compact, devs, devList, modEnabled("encsession"));
+}
+
+#ifndef LEGACY
+static bool
+collectFBC(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	return getFBC(sb, compact, devs, devList, modEnabled("fbcsession"));
+}
+#endif
+
+int
+modEnable(const char *name, bool enable) {
+	module_t *m = findModule(name, strlen(name));
+
+	if (m == NULL)
+		return 1;
+	m->enabled = enable;
+	return 0;
+}
+
+bool
+modEnabled(const char *name) {
+	module_t *m = findModule(name, strlen(name));
+
+	return m != NULL && m->enabled;
+}
+
+int
+modSelect(const char *name, size_t len, unsigned long long *mask) {
+	module_t *m = findModule(name, len);
+	uint i;
+
+	if (m == NULL)
+		return 1;
+	i = m - modules;
+	*mask |= 1ULL << i;
+	// session flags belong to the stat collector right before them
+	if (m->fn == NULL && i > 0)
+		*mask |= 1ULL << (i - 1);
+	return 0;
+}
+
+int
+modSetRefresh(const char *list) {
+	const char *s, *e, *c;
+	char *end;
+	module_t *m;
+	int *refresh;
+	long n;
+	int res = 0;
+
+	if (list == NULL)
+		return 0;
+
+	for (s = list; *s != '\0'; s = (*e == '\0') ? e : e + 1) {
+		e = strchr(s, ',');
+		if (e == NULL)
+			e = s + strlen(s);
+		if (e == s)
+			continue;
+		c = memchr(s, ':', e - s);
+		if (c == NULL) {
+			PROM_WARN("Missing refresh class for '%.*s'", (int) (e - s), s);
+			res++;
+			continue;
+		}
+		m = findModule(s, c - s);
+		if (m != NULL) {
+			refresh = &(m->refresh);
+		} else if ((c - s) == 6 && strncmp(s, "static", 6) == 0) {
+			refresh = &(statics.refresh);
+		} else {
+			PROM_WARN("Unknown metrics '%.*s'", (int) (c - s), s);
+			res++;
+			continue;
+		}
+		c++;
+		if ((e - c) == 5 && strncmp(c, "event", 5) == 0) {
+			*refresh = MOD_REFRESH_EVENT;
+			continue;
+		}
+		n = strtol(c, &end, 10);
+		if (end != e || end == c || n < 0 || n > 86400) {
+			PROM_WARN("Invalid refresh class '%.*s' for '%.*s'",
+				(int) (e - c), c, (int) (c - 1 - s), s);
+			res++;
+			continue;
+		}
+		*refresh = n;
+	}
+	return res;
+}
+
+void
+modCheckEvents(void) {
+	module_t *m;
+	uint i;
+
+	for (i = 0; i < MODULES; i++) {
+		m = &(modules[i]);
+		if (m->refresh != MOD_REFRESH_EVENT || eventsCover(m->name))
+			continue;
+		PROM_WARN("%s: no events to refresh on - collecting on every scrape",
+			m->name);
+		m->refresh = MOD_REFRESH_ALWAYS;
+	}
+}
+
+void
+modInvalidate(const char *name) {
+	module_t *m = findModule(name, strlen(name));
+
+	if (m != NULL)
+		atomic_store(&(m->dirty), true);
+}
+
+static bool
+isDue(module_t *m, time_t now) {
+	if (m->cache == NULL || atomic_exchange(&(m->dirty), false))
+		return true;
+	if (m->refresh == MOD_REFRESH_EVENT)
+		return false;
+	return (now - m->last) >= m->refresh;
+}
+
+void
+modCollect(psb_t *sb, bool compact, uint devs, gpu_t devList[],
+	unsigned long long mask)
+{
+	struct timespec ts;
+	module_t *m;
+	psb_t *msb;
+	uint i;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < MODULES; i++) {
+		m = &(modules[i]);
+		if (!m->enabled || m->fn == NULL || (mask & (1ULL << i)) == 0
+			|| (m->isStatic && skipStatic))
+		{
+			continue;
+		}
+		if (sb == NULL || m->refresh == MOD_REFRESH_ALWAYS) {
+			m->fn(sb, compact, devs, devList);
+			continue;
+		}
+		if (!isDue(m, ts.tv_sec)) {
+			PROM_DEBUG("%s: using cached output", m->name);
+			psb_add_str(sb, m->cache);
+			continue;
+		}
+		msb = psb_new();
+		if (msb == NULL) {
+			m->fn(sb, compact, devs, devList);
+			continue;
+		}
+		m->fn(msb, compact, devs, devList);
+		free(m->cache);
+		m->cache = psb_dump(msb);
+		psb_destroy(msb);
+		m->last = ts.tv_sec;
+		if (m->cache != NULL)
+			psb_add_str(sb, m->cache);
+	}
+}
+
+// FNV-1a
+static unsigned long long
+hash(const char *s) {
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	for (; *s != '\0'; s++) {
+		h ^= (unsigned char) *s;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+char *
+modStatic(bool compact, uint devs, gpu_t devList[], const char **etag) {
+	struct timespec ts;
+	psb_t *ssb;
+	char *body;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (statics.body != NULL && (statics.refresh == MOD_REFRESH_EVENT
+		|| (ts.tv_sec - statics.last) < statics.refresh))
+	{
+		goto end;
+	}
+
+	ssb = psb_new();
+	if (ssb == NULL)
+		goto end;
+	// probe again: limits, clocks, etc. may have been changed meanwhile
+	if (statics.body != NULL)
+		resetStatic(devs, devList);
+	PROM_DEBUG("Probing static metrics", "");
+	if (modEnabled("version"))
+		getVersions(ssb, compact);
+	if (modEnabled("gpuinfo"))
+		getDevInfos(ssb, compact, devs, devList);
+	if (modEnabled("topology"))
+		getTopology(ssb, compact, devs, devList);
+	if (modEnabled("clock"))
+		getClocksStatic(ssb, compact, devs, devList);
+	if (modEnabled("temperature"))
+		getTemperatureThresholds(ssb, compact, devs, devList);
+	if (modEnabled("power"))
+		getPowerLimits(ssb, compact, devs, devList);
+	if (modEnabled("pcie"))
+		getPCIeLinkInfo(ssb, compact, devs, devList);
+	if (modEnabled("nvlink"))
+		getNvLinkStatic(ssb, compact, devs, devList);
+	body = psb_dump(ssb);
+	psb_destroy(ssb);
+	if (body == NULL)
+		goto end;
+
+	free(statics.body);
+	statics.body = body;
+	statics.last = ts.tv_sec;
+	snprintf(statics.etag, sizeof(statics.etag), "\"%016llx\"", hash(body));
+
+end:
+	*etag = statics.etag;
+	return statics.body;
+}
+
+void
+modCleanup(void) {
+	uint i;
+
+	for (i = 0; i < MODULES; i++) {
+		free(modules[i].cache);
+		modules[i].cache = NULL;
+	}
+	free(statics.body);
+	statics.body = NULL;
+	freeProcs();
+	freeAccounting();
+}
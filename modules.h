@@ -0,0 +1,125 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file modules.h
+ * Registry of all GPU metric modules (collectors) incl. their refresh class
+ * and the cached output of their last collection.
+ */
+
+#ifndef NVMEX_MODULES_H
+#define NVMEX_MODULES_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Collect the module's metrics on each scrape (default). */
+#define MOD_REFRESH_ALWAYS	0
+/** Collect the module's metrics once and thereafter on invalidation, only. */
+#define MOD_REFRESH_EVENT	-1
+
+/** Selection mask, which selects all modules. */
+#define MOD_ALL	(~0ULL)
+
+/**
+ * Enable or disable the module with the given name.
+ * @param name	name of the module as used by option \c -n .
+ * @param enable	\c true to enable, \c false to disable the module.
+ * @return \c 0 on success, \c 1 if there is no module with the given name.
+ */
+int modEnable(const char *name, bool enable);
+
+/**
+ * Check whether the module with the given name is enabled.
+ * @param name	name of the module as used by option \c -n .
+ * @return \c true if it is known and enabled, \c false otherwise.
+ */
+bool modEnabled(const char *name);
+
+/**
+ * Add the module with the given name to a selection mask.
+ * @param name	name of the module as used by option \c -n .
+ * @param len	number of characters of \c name to use.
+ * @param mask	where to set the bit of the module. Selecting a session flag
+ *	(e.g. \c encsession ) selects the related collector as well.
+ * @return \c 0 on success, \c 1 if there is no module with the given name.
+ */
+int modSelect(const char *name, size_t len, unsigned long long *mask);
+
+/**
+ * Set the refresh class of modules.
+ * @param list	comma separated list of \c name:class tupels, where class is
+ *	either \c 0 (collect on every scrape), the number of seconds the cached
+ *	output of the module should be used before it gets collected again, or
+ *	\c event (collect on invalidation, only). The name \c static sets the
+ *	interval for probing the metrics of \c modStatic() again.
+ * @return the number of invalid entries found in the given \c list .
+ */
+int modSetRefresh(const char *list);
+
+/**
+ * Switch all modules with refresh class \c event , whose output does not get
+ * invalidated by events (see \c eventsCover() ), to collect on every scrape.
+ * Should be called after the event thread got started (or not).
+ */
+void modCheckEvents(void);
+
+/**
+ * Mark the cached output of the module with the given name as stale, so that
+ * it gets collected on the next scrape. May be called from any thread.
+ * @param name	name of the module as used by option \c -n .
+ */
+void modInvalidate(const char *name);
+
+/**
+ * Collect the metrics of all enabled modules. Modules, which are not due,
+ * contribute the output of their last collection instead.
+ * @param sb	where to append the metrics. If \c NULL , each module prints
+ *	its metrics to stdout and no caching happens.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @param mask	collect enabled modules selected in this mask, only. See
+ *	\c modSelect() and \c MOD_ALL .
+ */
+void modCollect(psb_t *sb, bool compact, uint devs, gpu_t devList[],
+	unsigned long long mask);
+
+/**
+ * Get the static metrics of all enabled modules, i.e. the metrics which get
+ * omitted by the collectors if \c skipStatic is set. They get probed again,
+ * if the refresh interval of \c static (see \c modSetRefresh() , default:
+ * 300 s) has been expired.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @param etag	where to store the pointer to the quoted ETag of the returned
+ *	metrics. It changes whenever the metrics change.
+ * @return the prom formatted static metrics, or \c NULL if not yet available
+ *	(out of memory). The caller must not free it, and it is valid until the
+ *	next call of this function, only.
+ */
+char *modStatic(bool compact, uint devs, gpu_t devList[],
+	const char **etag);
+
+/**
+ * Free all cached module output.
+ */
+void modCleanup(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_MODULES_H
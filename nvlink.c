@@ -11,8 +11,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "nvlink.h"
+#include "rate.h"
 
 
 static uint fields[] = {
@@ -49,6 +51,187 @@ static const char *fmt[] = {
 	NVMEXM_NVLINK_TRAFFIC_N "{gpu=\"%d\",type=\"raw\",value=\"rx\",link=\"all\",uid=\"%s\"} %llu\n"
 };
 
+// labels of the traffic totals data tx, data rx, raw tx, raw rx
+static const char *tlabel[] = {
+	"type=\"data\",value=\"tx\"",
+	"type=\"data\",value=\"rx\"",
+	"type=\"raw\",value=\"tx\"",
+	"type=\"raw\",value=\"rx\""
+};
+
+// append the rate of the traffic total t (index into tlabel) if available
+static void
+addRate(gpu_t *gpu, uint t, unsigned long long val, psb_t *sb_rate) {
+	char buf[MBUF_SZ];
+	double rate;
+
+	if (!rtUpdate(gpu, RT_NVLINK_DATA_TX + t, val, &rate))
+		return;
+	snprintf(buf, sizeof(buf), NVMEXM_NVLINK_TRAFFIC_RATE_N
+		"{gpu=\"%d\",%s,link=\"all\",uid=\"%s\"} %.0f\n",
+		gpu->idx, tlabel[t], gpu->uuid, rate);
+	psb_add_str(sb_rate, buf);
+}
+
+_Static_assert(NVML_NVLINK_MAX_LINKS <= sizeof(uint) * 8,
+	"too many NVLinks for the active link mask");
+
+#ifdef NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX
+// fields queried per active link, scopeId is the link
+static uint lfields[] = {
+	NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX,
+	NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_RX,
+#ifdef NVML_FI_DEV_NVLINK_ERROR_DL_CRC
+	NVML_FI_DEV_NVLINK_ERROR_DL_CRC,		// 164  NVLink CRC error counter
+	NVML_FI_DEV_NVLINK_ERROR_DL_REPLAY,		// 162  NVLink replay counter
+	NVML_FI_DEV_NVLINK_ERROR_DL_RECOVERY,	// 163  NVLink recovery counter
+#endif
+};
+#define LFIELDS (sizeof(lfields)/sizeof(uint))
+
+static const char *lfmt[] = {
+	NVMEXM_NVLINK_TRAFFIC_N "{gpu=\"%d\",type=\"data\",value=\"tx\",link=\"%u\",uid=\"%s\"} %llu\n",
+	NVMEXM_NVLINK_TRAFFIC_N "{gpu=\"%d\",type=\"data\",value=\"rx\",link=\"%u\",uid=\"%s\"} %llu\n",
+	NVMEXM_NVLINK_LERR_N "{gpu=\"%d\",type=\"crc\",link=\"%u\",uid=\"%s\"} %llu\n",
+	NVMEXM_NVLINK_LERR_N "{gpu=\"%d\",type=\"replay\",link=\"%u\",uid=\"%s\"} %llu\n",
+	NVMEXM_NVLINK_LERR_N "{gpu=\"%d\",type=\"recovery\",link=\"%u\",uid=\"%s\"} %llu\n"
+};
+
+// append the per link requests of all active links, return their number
+static uint
+addLinkFields(gpu_t *gpu, nvmlFieldValue_t *fvals) {
+	uint k, l, n = 0;
+
+	for (l = 0; l < NVML_NVLINK_MAX_LINKS; l++) {
+		if ((gpu->nvLinkMask & (1U << l)) == 0)
+			continue;
+		for (k = 0; k < LFIELDS; k++) {
+			fvals[n].fieldId = lfields[k];
+			fvals[n].scopeId = l;
+			n++;
+		}
+	}
+	return n;
+}
+
+// tx and rx bytes of all links to the same peer
+typedef struct peer_st {
+	short	peer;		//!< see gpu_t.nvLinkPeer
+	unsigned long long	val[2];
+} peer_t;
+
+// sum up the tx/rx values of a link to its peer
+static uint
+addPeer(peer_t peers[], uint np, short peer, uint k, unsigned long long val) {
+	uint p;
+
+	if (peer == NVLINK_PEER_UNKNOWN)
+		return np;
+	for (p = 0; p < np && peers[p].peer != peer; p++)
+		;
+	if (p == np) {
+		memset(&(peers[p]), 0, sizeof(peer_t));
+		peers[p].peer = peer;
+		np++;
+	}
+	peers[p].val[k] += val;
+	return np;
+}
+
+static void
+addPeerValues(gpu_t *gpu, peer_t peers[], uint np, psb_t *sb_peer) {
+	char buf[MBUF_SZ], pname[16];
+	uint p, k;
+
+	for (p = 0; p < np; p++) {
+		if (peers[p].peer == NVLINK_PEER_OTHER)
+			strcpy(pname, "other");
+		else
+			snprintf(pname, sizeof(pname), "%d", peers[p].peer);
+		for (k = 0; k < 2; k++) {
+			snprintf(buf, sizeof(buf), NVMEXM_NVLINK_PEER_N
+				"{gpu=\"%d\",peer=\"%s\",value=\"%s\",uid=\"%s\"} %llu\n",
+				gpu->idx, pname, k == 0 ? "tx" : "rx", gpu->uuid,
+				peers[p].val[k]);
+			psb_add_str(sb_peer, buf);
+		}
+	}
+}
+
+/*
+ * Render the per link values and their sums per peer GPU. A link, which
+ * answers none of its fields, does not get asked again until the static
+ * metrics get re-probed. To keep the sums monotonic, they always include
+ * the last tx/rx values of all links ever read, even if a link failed or
+ * got dropped. Returns the number of successfully read values.
+ */
+static uint
+addLinkValues(gpu_t *gpu, nvmlFieldValue_t *fvals, uint n, psb_t *sb_txrx,
+	psb_t *sb_err, psb_t *sb_peer)
+{
+	char buf[MBUF_SZ];
+	uint i, k, l, ok, np = 0, total = 0;
+	unsigned long long val;
+	peer_t peers[NVML_NVLINK_MAX_LINKS];
+
+	for (i = 0; i < n; i += LFIELDS) {
+		ok = 0;
+		for (k = 0; k < LFIELDS; k++) {
+			if (fvals[i + k].nvmlReturn != NVML_SUCCESS)
+				continue;
+			ok++;
+			val = fvals[i + k].value.ullVal;
+			if (k < 2) {
+				val <<= 10;		// KiB
+				gpu->nvLinkBytes[fvals[i].scopeId][k] = val;
+				gpu->nvLinkBytesMask |= 1U << fvals[i].scopeId;
+			}
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+			snprintf(buf, sizeof(buf), lfmt[k], gpu->idx, fvals[i].scopeId,
+				gpu->uuid, val);
+#pragma GCC diagnostic pop
+			psb_add_str(k < 2 ? sb_txrx : sb_err, buf);
+		}
+		if (ok == 0) {
+			PROM_DEBUG("GPU %u: NVLink %u dropped", gpu->idx,fvals[i].scopeId);
+			gpu->nvLinkMask &= ~(1U << fvals[i].scopeId);
+		}
+		total += ok;
+	}
+	for (l = 0; l < NVML_NVLINK_MAX_LINKS; l++) {
+		if ((gpu->nvLinkBytesMask & (1U << l)) == 0)
+			continue;
+		for (k = 0; k < 2; k++)
+			np = addPeer(peers, np, gpu->nvLinkPeer[l], k,
+				gpu->nvLinkBytes[l][k]);
+	}
+	addPeerValues(gpu, peers, np, sb_peer);
+	return total;
+}
+#else
+#define LFIELDS 0
+#define addLinkFields(x, y)	0
+#define addLinkValues(a, b, c, d, e, f)	0
+#endif
+
+// the links in state up
+static uint
+activeLinks(gpu_t *gpu) {
+	nvmlEnableState_t state;
+	uint k, mask = 0;
+
+	for (k = 0; k < NVML_NVLINK_MAX_LINKS; k++) {
+		if (nvmlDeviceGetNvLinkState(gpu->dev, k, &state) == NVML_SUCCESS
+			&& state == NVML_FEATURE_ENABLED)
+		{
+			mask |= 1U << k;
+		}
+	}
+	PROM_DEBUG("GPU %u: active NVLinks 0x%x", gpu->idx, mask);
+	return mask;
+}
+
 #ifndef NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX
 static void
 initTrafficCounterLegacy(gpu_t *gpu) {
@@ -77,7 +260,7 @@ initTrafficCounterLegacy(gpu_t *gpu) {
 }
 
 static void
-countTxRxLegacy(gpu_t *gpu, psb_t *sb) {
+countTxRxLegacy(gpu_t *gpu, psb_t *sb, psb_t *sb_rate) {
 	if (gpu->nvLinks < 1 || gpu->nvLinkSkipTxRx[NVML_NVLINK_MAX_LINKS] == 1)
 		return;
 
@@ -90,8 +273,12 @@ countTxRxLegacy(gpu_t *gpu, psb_t *sb) {
 	// sum up all links
 	e = 0;
 	for (k = 0; k < NVML_NVLINK_MAX_LINKS; k++) {
-		if (gpu->nvLinkSkipTxRx[k] == 1)
+		if (gpu->nvLinkSkipTxRx[k] == 1
+			|| (gpu->nvLinkMask & (1U << k)) == 0)
+		{
+			e++;
 			continue;
+		}
 		res = nvmlDeviceGetNvLinkUtilizationCounter(gpu->dev, k, 0, &rx, &tx);
 		if (res == NVML_SUCCESS) {
 			rxa += rx;
@@ -118,11 +305,13 @@ countTxRxLegacy(gpu_t *gpu, psb_t *sb) {
 	snprintf(buf, sizeof(buf), fmt[7], gpu->idx, gpu->uuid, txa);
 	psb_add_str(sb, buf);
 #pragma GCC diagnostic pop
+	addRate(gpu, 2, rxa, sb_rate);
+	addRate(gpu, 3, txa, sb_rate);
 }
 
 #else
-#define initTrafficCounterLegacy(x)
-#define countTxRxLegacy(x, y)
+#define initTrafficCounterLegacy(x)	((void) 0)
+#define countTxRxLegacy(x, y, z)
 #endif
 
 static bool
@@ -132,7 +321,7 @@ checkStatic(gpu_t *gpu) {
 
 	nvmlReturn_t res;
 	char buf[MBUF_SZ];
-	uint k;
+	uint k, links = gpu->nvLinks;
 
 	uint stats[] = {
 		// 90  Common NVLink Speed in MBps for active links
@@ -174,25 +363,57 @@ checkStatic(gpu_t *gpu) {
 		gpu->nvLinkCount = strdup("");
 		gpu->nvLinks = 0;
 	}
-	initTrafficCounterLegacy(gpu);
+	gpu->nvLinkMask = gpu->nvLinks > 0 ? activeLinks(gpu) : 0;
+	// a re-probe must not reset the traffic counters
+	if (links == 0)
+		initTrafficCounterLegacy(gpu);
 	return true;
 }
 
+bool
+getNvLinkStatic(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	uint i;
+	size_t sz = psb_len(sb);
+	psb_t *sb_bw = psb_new();
+
+	if (sb_bw == NULL)
+		return false;
+
+	if (!compact)
+		addPromInfo(NVMEXM_NVLINK_COUNT);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || !checkStatic(gpu))
+			continue;
+		psb_add_str(sb, gpu->nvLinkCount);
+		if (gpu->nvLinks != 0)
+			psb_add_str(sb_bw, gpu->nvLinkBW);
+	}
+	if (!compact)
+		addPromInfo(NVMEXM_NVLINK_BW);
+	psb_add_str(sb, psb_str(sb_bw));
+	psb_destroy(sb_bw);
+
+	return psb_len(sb) != sz;
+}
+
 bool
 getNvLink(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	nvmlReturn_t res;
 	gpu_t *gpu;
 	size_t sz;
-	uint i, k, e, max = sizeof(fields)/sizeof(uint);
+	uint i, k, e, n, max = sizeof(fields)/sizeof(uint);
+	size_t len = max + LFIELDS * NVML_NVLINK_MAX_LINKS;
 	char buf[MBUF_SZ];
 	bool free_sb = sb == NULL;
 	nvmlFieldValue_t *fvals = NULL;
-	psb_t *sb_txrx, *sb_bw, *sb_err;
+	psb_t *sb_txrx, *sb_bw, *sb_err, *sb_lerr, *sb_peer, *sb_rate;
 
 	if (devs == 0)
 		return false;
 
-	sb_txrx = sb_bw = sb_err = NULL;
+	sb_txrx = sb_bw = sb_err = sb_lerr = sb_peer = sb_rate = NULL;
 
 	PROM_DEBUG("getNvLink", "");
 
@@ -203,91 +424,134 @@ getNvLink(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	sb_txrx = psb_new();
 	sb_bw = psb_new();
 	sb_err = psb_new();
-	if (sb_txrx == NULL || sb_bw == NULL || sb_err == NULL)
+	sb_lerr = psb_new();
+	sb_peer = psb_new();
+	sb_rate = psb_new();
+	if (sb_txrx == NULL || sb_bw == NULL || sb_err == NULL || sb_lerr == NULL
+		|| sb_peer == NULL || sb_rate == NULL)
+	{
 		goto fail;
+	}
 
-	fvals = malloc(sizeof(nvmlFieldValue_t) * max);
+	// all links of a GPU get fetched with a single call
+	fvals = malloc(sizeof(nvmlFieldValue_t) * len);
 	if (fvals == NULL)
 		goto fail;
-	memset(fvals, 0, sizeof(nvmlFieldValue_t) * max);
+	memset(fvals, 0, sizeof(nvmlFieldValue_t) * len);
 	for (i = 0; i < max; i++) {
 		fvals[i].fieldId = fields[i];
+#ifdef NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX
+		// sum of all links
+		if (fields[i] >= NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX
+			&& fields[i] <= NVML_FI_DEV_NVLINK_THROUGHPUT_RAW_RX)
+			fvals[i].scopeId = UINT_MAX;
+#endif
 	}
 
-	if (!compact)
+	if (!compact && !skipStatic)
 		addPromInfo(NVMEXM_NVLINK_COUNT);
 
 	for (i = 0; i < devs; i++) {
 		gpu = &(devList[i]);
 		if (gpu->dev == NULL || !checkStatic(gpu))
 			continue;
-		psb_add_str(sb, gpu->nvLinkCount);
+		if (!skipStatic)
+			psb_add_str(sb, gpu->nvLinkCount);
 
 		if (gpu->nvLinks == 0)
 			continue;
-		psb_add_str(sb_bw, gpu->nvLinkBW);
+		if (!skipStatic)
+			psb_add_str(sb_bw, gpu->nvLinkBW);
 
 		if (gpu->hasNvLinks != -1) {
-			res = nvmlDeviceGetFieldValues(gpu->dev, max, fvals);
+			n = max + addLinkFields(gpu, fvals + max);
+			res = nvmlDeviceGetFieldValues(gpu->dev, n, fvals);
 			if (NVML_SUCCESS == res) {
 				e = 0;
 				for (k = 0; k < max; k++) {
-					if (res != NVML_SUCCESS) {
+					if (fvals[k].nvmlReturn != NVML_SUCCESS) {
 						e++;
-						if (res == NVML_ERROR_NO_PERMISSION
+						if (fvals[k].nvmlReturn == NVML_ERROR_NO_PERMISSION
 							&& gpu->nvLinkFieldError == 0)
 						{
 							PROM_WARN("NVlink field[%u] GPU %u: %s",
-								fvals[k].fieldId, i, nverror(res));
+								fvals[k].fieldId, gpu->idx,
+								nverror(fvals[k].nvmlReturn));
 							gpu->nvLinkFieldError = 1;
 						}
 						PROM_DEBUG("NVlink field[%u]: %s",
-								fvals[k].fieldId, nverror(res));
+								fvals[k].fieldId, nverror(fvals[k].nvmlReturn));
 						continue;
 					}
 					unsigned long long val; 
 #ifdef NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX
 					if (fvals[k].fieldId >= NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX
 						&& fvals[k].fieldId <= NVML_FI_DEV_NVLINK_THROUGHPUT_RAW_RX)
+					{
 						val = fvals[k].value.ullVal << 10;
-					else
+						addRate(gpu, fvals[k].fieldId
+							- NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX, val, sb_rate);
+					} else
 #endif
 						val = fvals[k].value.ullVal;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-nonliteral"
-					snprintf(buf, sizeof(buf), fmt[k], i, gpu->uuid, val);
+					snprintf(buf, sizeof(buf), fmt[k], gpu->idx, gpu->uuid,
+						val);
 #pragma GCC diagnostic pop
 					if (fvals[k].fieldId <= NVML_FI_DEV_NVLINK_RECOVERY_ERROR_COUNT_TOTAL)
 						psb_add_str(sb_err, buf);
 					else
 						psb_add_str(sb_txrx, buf);
-					if (e == max && gpu->hasNvLinks == 0) {
-						PROM_DEBUG("gpu.hasNvLinks = -1", "");
-						gpu->hasNvLinks = -1;
-					}
+				}
+				if (addLinkValues(gpu, fvals + max, n - max, sb_txrx, sb_lerr,
+					sb_peer) == 0 && e == max && gpu->hasNvLinks == 0)
+				{
+					PROM_DEBUG("gpu.hasNvLinks = -1", "");
+					gpu->hasNvLinks = -1;
+				} else {
+					gpu->hasNvLinks = 1;
 				}
 			} else if (NOT_AVAIL(res)) {
 				PROM_DEBUG("gpu.hasNvLinks = -1", "");
 				gpu->hasNvLinks = -1;
 			}
 		}
-		countTxRxLegacy(gpu, sb_txrx);
+		countTxRxLegacy(gpu, sb_txrx, sb_rate);
 	}
 
-	if (!compact)
+	if (!compact && !skipStatic)
 		addPromInfo(NVMEXM_NVLINK_BW);
 	psb_add_str(sb, psb_str(sb_bw));
 	if (!compact)
 		addPromInfo(NVMEXM_NVLINK_TRAFFIC);
 	psb_add_str(sb, psb_str(sb_txrx));
+	if (psb_len(sb_rate) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_NVLINK_TRAFFIC_RATE);
+		psb_add_str(sb, psb_str(sb_rate));
+	}
 	if (!compact)
 		addPromInfo(NVMEXM_NVLINK_ERR);
 	psb_add_str(sb, psb_str(sb_err));
+	if (psb_len(sb_lerr) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_NVLINK_LERR);
+		psb_add_str(sb, psb_str(sb_lerr));
+	}
+	if (psb_len(sb_peer) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_NVLINK_PEER);
+		psb_add_str(sb, psb_str(sb_peer));
+	}
 
 fail:
 	psb_destroy(sb_bw);
 	psb_destroy(sb_txrx);
 	psb_destroy(sb_err);
+	psb_destroy(sb_lerr);
+	psb_destroy(sb_peer);
+	psb_destroy(sb_rate);
 	free(fvals);
 
 	sz = psb_len(sb) - sz;
@@ -8,9 +8,140 @@
  *
  * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
  */
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "pcie.h"
+#include "rcache.h"
+#include "rate.h"
+
+// seconds between two samples of the PCIe throughput
+#define SAMPLE_INTERVAL 1
+
+typedef struct sampler_st {
+	gpu_t	*gpu;
+	pthread_t	thread;
+	atomic_ullong	txrx;	//!< KB/s of the last sample: tx << 32 | rx
+	atomic_int	res;		//!< result of the last sample, txrx is valid
+							//!< on NVML_SUCCESS, only
+} sampler_t;
+
+static struct {
+	sampler_t	*s;
+	uint	count;
+	atomic_bool	stop;
+} ps = { .s = NULL, .count = 0 };
+
+static int
+probeCounters(gpu_t *gpu) {
+#ifdef NVML_FI_DEV_PCIE_COUNT_TX_BYTES
+	nvmlFieldValue_t fvals[2];
+
+	memset(fvals, 0, sizeof(fvals));
+	fvals[0].fieldId = NVML_FI_DEV_PCIE_COUNT_TX_BYTES;
+	fvals[1].fieldId = NVML_FI_DEV_PCIE_COUNT_RX_BYTES;
+	if (nvmlDeviceGetFieldValues(gpu->dev, 2, fvals) == NVML_SUCCESS
+		&& fvals[0].nvmlReturn == NVML_SUCCESS
+		&& fvals[1].nvmlReturn == NVML_SUCCESS)
+	{
+		PROM_DEBUG("gpu.hasPCIeCount = 1", "");
+		gpu->hasPCIeCount = 1;
+		return 1;
+	}
+#endif
+	PROM_DEBUG("gpu.hasPCIeCount = -1", "");
+	gpu->hasPCIeCount = -1;
+	return -1;
+}
+
+// Each nvmlDeviceGetPcieThroughput() call samples for about 20 ms, so do it
+// in the background and let the scrape just pick up the last result.
+static void *
+sampleLoop(void *arg) {
+	sampler_t *s = arg;
+	nvmlReturn_t res, res2;
+	uint tx, rx;
+	struct timespec ts = { .tv_sec = SAMPLE_INTERVAL, .tv_nsec = 0 };
+
+	while (!atomic_load(&(ps.stop))) {
+		res = nvmlDeviceGetPcieThroughput(s->gpu->dev,
+			NVML_PCIE_UTIL_TX_BYTES, &tx);
+		res2 = nvmlDeviceGetPcieThroughput(s->gpu->dev,
+			NVML_PCIE_UTIL_RX_BYTES, &rx);
+		if (NVML_SUCCESS == res)
+			res = res2;
+		if (NVML_SUCCESS == res)
+			atomic_store(&(s->txrx), ((unsigned long long) tx << 32) | rx);
+		// the scrape marks the GPU as unsupported, so no need to go on
+		atomic_store(&(s->res), res);
+		if (NOT_AVAIL(res)) {
+			PROM_DEBUG("GPU %u: PCIe throughput not available", s->gpu->idx);
+			break;
+		}
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+uint
+startPCIeSampler(uint devs, gpu_t devList[]) {
+	uint i;
+	gpu_t *gpu;
+	sampler_t *s;
+
+	if (ps.s != NULL || devs == 0)
+		return 1;
+	ps.s = calloc(devs, sizeof(sampler_t));
+	if (ps.s == NULL)
+		return 1;
+	atomic_store(&(ps.stop), false);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasPCIeUtil == -1)
+			continue;
+		if (gpu->hasPCIeCount == 0 && probeCounters(gpu) == 1)
+			continue;
+		s = &(ps.s[ps.count]);
+		s->gpu = gpu;
+		atomic_init(&(s->txrx), 0);
+		atomic_init(&(s->res), NVML_ERROR_NOT_FOUND);
+		if (pthread_create(&(s->thread), NULL, sampleLoop, s) != 0) {
+			PROM_WARN("Unable to start PCIe sampler for GPU %u", gpu->idx);
+			continue;
+		}
+		ps.count++;
+	}
+	PROM_DEBUG("%u PCIe sampler started", ps.count);
+	return 0;
+}
+
+void
+stopPCIeSampler(void) {
+	uint i;
+
+	if (ps.s == NULL)
+		return;
+	atomic_store(&(ps.stop), true);
+	for (i = 0; i < ps.count; i++)
+		pthread_join(ps.s[i].thread, NULL);
+	free(ps.s);
+	ps.s = NULL;
+	ps.count = 0;
+}
+
+static sampler_t *
+findSampler(gpu_t *gpu) {
+	uint i;
+
+	for (i = 0; i < ps.count; i++) {
+		if (ps.s[i].gpu == gpu)
+			return &(ps.s[i]);
+	}
+	return NULL;
+}
 
 static int
 setLinkInfo(gpu_t *gpu) {
@@ -38,16 +169,42 @@ setLinkInfo(gpu_t *gpu) {
 			NVMEXM_PCIE_LINK_N "{gpu=\"%d\",value=\"Width\",uuid=\"%s\"} %u\n",
 			gpu->idx, gpu->uuid, val);
 	}
+	// used to be a second "Width" series, i.e. a duplicate
 	res = nvmlDeviceGetMaxPcieLinkWidth(gpu->dev, &val);
 	if (NVML_SUCCESS == res) {
 		len += snprintf(buf + len, sizeof(buf) - len,
-			NVMEXM_PCIE_LINK_N "{gpu=\"%d\",value=\"Width\",uuid=\"%s\"} %u\n",
+			NVMEXM_PCIE_LINK_N "{gpu=\"%d\",value=\"maxWidth\",uuid=\"%s\"} %u\n",
 			gpu->idx, gpu->uuid, val);
 	}
 	gpu->pcieLinkInfo = strdup(buf);
 	return len == 0 ? 0 : 1;
 }
 
+bool
+getPCIeLinkInfo(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	uint i, c = 0;
+
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL)
+			continue;
+		c += (gpu->pcieLinkInfo == NULL)
+			? setLinkInfo(gpu)
+			: (gpu->pcieLinkInfo[0] == '\0' ? 0 : 1);
+	}
+	if (c == 0)
+		return false;
+
+	if (!compact)
+		addPromInfo(NVMEXM_PCIE_LINK);
+	for (i = 0; i < devs; i++) {
+		if (devList[i].pcieLinkInfo != NULL)
+			psb_add_str(sb, devList[i].pcieLinkInfo);
+	}
+	return true;
+}
+
 bool
 getPCIe(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	nvmlReturn_t res, res2;
@@ -56,6 +213,10 @@ getPCIe(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	uint i, v, w, c = 0;
 	char buf[MBUF_SZ];
 	bool free_sb = sb == NULL;
+	sampler_t *s;
+	unsigned long long txrx;
+	double rate;
+	psb_t *sbr;
 
 	if (devs == 0)
 		return false;
@@ -65,28 +226,75 @@ getPCIe(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		sb = psb_new();
 	sz = psb_len(sb);
 
+#ifdef NVML_FI_DEV_PCIE_COUNT_TX_BYTES
+	if (!compact)
+		addPromInfo(NVMEXM_PCIE_BYTES);
+	for (i = 0; i < devs; i++) {
+		nvmlFieldValue_t fvals[2];
+
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasPCIeCount == -1
+			|| (gpu->hasPCIeCount == 0 && probeCounters(gpu) == -1))
+		{
+			continue;
+		}
+		memset(fvals, 0, sizeof(fvals));
+		fvals[0].fieldId = NVML_FI_DEV_PCIE_COUNT_TX_BYTES;
+		fvals[1].fieldId = NVML_FI_DEV_PCIE_COUNT_RX_BYTES;
+		res = nvmlDeviceGetFieldValues(gpu->dev, 2, fvals);
+		if (NVML_SUCCESS != res || fvals[0].nvmlReturn != NVML_SUCCESS
+			|| fvals[1].nvmlReturn != NVML_SUCCESS)
+		{
+			continue;
+		}
+		snprintf(buf, sizeof(buf),
+			NVMEXM_PCIE_BYTES_N "{gpu=\"%d\",value=\"tx\",uuid=\"%s\"} %llu\n",
+			gpu->idx, gpu->uuid, fvals[0].value.ullVal);
+		psb_add_str(sb, buf);
+		snprintf(buf, sizeof(buf),
+			NVMEXM_PCIE_BYTES_N "{gpu=\"%d\",value=\"rx\",uuid=\"%s\"} %llu\n",
+			gpu->idx, gpu->uuid, fvals[1].value.ullVal);
+		psb_add_str(sb, buf);
+	}
+#endif
+
 	if (!compact)
 		addPromInfo(NVMEXM_PCIE_UTIL);
 	for (i = 0; i < devs; i++) {
 		gpu = &(devList[i]);
 		if (gpu->dev == NULL || gpu->hasPCIeUtil == -1)
 			continue;
-		res = nvmlDeviceGetPcieThroughput(gpu->dev, NVML_PCIE_UTIL_TX_BYTES,&v);
-		res2 = nvmlDeviceGetPcieThroughput(gpu->dev,NVML_PCIE_UTIL_RX_BYTES,&w);
+		if (gpu->hasPCIeCount == 1) {
+			// there are proper counters, so skip the 20 ms samples
+			res = res2 = NVML_ERROR_NOT_FOUND;
+		} else if ((s = findSampler(gpu)) != NULL) {
+			res = atomic_load(&(s->res));
+			txrx = atomic_load(&(s->txrx));
+			v = txrx >> 32;
+			w = txrx & 0xFFFFFFFF;
+			res2 = NVML_SUCCESS;
+		} else {
+			res = nvmlDeviceGetPcieThroughput(gpu->dev,
+				NVML_PCIE_UTIL_TX_BYTES, &v);
+			res2 = nvmlDeviceGetPcieThroughput(gpu->dev,
+				NVML_PCIE_UTIL_RX_BYTES, &w);
+		}
 		if (NVML_SUCCESS == res && NVML_SUCCESS == res2) {
 			snprintf(buf, sizeof(buf),
 				NVMEXM_PCIE_UTIL_N "{gpu=\"%d\",value=\"tx\",uuid=\"%s\"} %ld\n",
-				i, gpu->uuid, v * 1000L);
+				gpu->idx, gpu->uuid, v * 1000L);
 			psb_add_str(sb, buf);
 			snprintf(buf, sizeof(buf),
 				NVMEXM_PCIE_UTIL_N "{gpu=\"%d\",value=\"rx\",uuid=\"%s\"} %ld\n",
-				i, gpu->uuid, w * 1000L);
+				gpu->idx, gpu->uuid, w * 1000L);
 			psb_add_str(sb, buf);
 			gpu->hasPCIeUtil = 1;
 		} else if (NOT_AVAIL(res)) {
 			PROM_DEBUG("gpu.hasPCIeUtil = -1", "");
 			gpu->hasPCIeUtil = -1;
 		}
+		if (skipStatic)
+			continue;
 		c += (gpu->pcieLinkInfo == NULL)
 			? setLinkInfo(gpu)
 			: (gpu->pcieLinkInfo[0] == '\0' ? 0 : 1);
@@ -94,22 +302,34 @@ getPCIe(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 
 	if (!compact)
 		addPromInfo(NVMEXM_PCIE_REPLAY);
+	sbr = psb_new();
 	for (i = 0; i < devs; i++) {
 		gpu = &(devList[i]);
 		if (gpu->dev == NULL || gpu->hasPCIeReplay == -1)
 			continue;
 		res = nvmlDeviceGetPcieReplayCounter(gpu->dev, &v);
 		if (NVML_SUCCESS == res) {
-			snprintf(buf, sizeof(buf),
+			psb_add_str(sb, rcRender(gpu, RC_PCIE_REPLAY, v,
 				NVMEXM_PCIE_REPLAY_N "{gpu=\"%d\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, v);
-			psb_add_str(sb, buf);
+				gpu->idx, gpu->uuid, v));
 			gpu->hasPCIeReplay = 1;
+			if (sbr != NULL && rtUpdate(gpu, RT_PCIE_REPLAY, v, &rate)) {
+				snprintf(buf, sizeof(buf), NVMEXM_PCIE_REPLAY_RATE_N
+					"{gpu=\"%d\",uuid=\"%s\"} %g\n",
+					gpu->idx, gpu->uuid, rate);
+				psb_add_str(sbr, buf);
+			}
 		} else if (NOT_AVAIL(res)) {
 			PROM_DEBUG("gpu.hasPCIeReplay = -1", "");
 			gpu->hasPCIeReplay = -1;
 		}
 	}
+	if (sbr != NULL && psb_len(sbr) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_PCIE_REPLAY_RATE);
+		psb_add_str(sb, psb_str(sbr));
+	}
+	psb_destroy(sbr);
 
 	if (c > 0) {
 		if (!compact)
@@ -34,6 +34,32 @@ extern "C" {
  */
 bool getPCIe(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
 
+/**
+ * Start a background thread per device, which continuously samples the PCIe
+ * throughput, so that \c getPCIe() does not need to wait for it. Devices
+ * providing cumulative PCIe byte counters get no thread.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to sample. Must not be \c NULL and must
+ *	stay valid until \c stopPCIeSampler() got called!
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+uint startPCIeSampler(uint devs, gpu_t devList[]);
+
+/**
+ * Stop all PCIe sampler threads and release related resources.
+ */
+void stopPCIeSampler(void);
+
+/**
+ * Get PCIe link info metrics, only.
+ * @param sb	where to append the metrics. Must not be \c NULL !
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getPCIeLinkInfo(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,205 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pcihealth.h"
+
+enum {
+	AER_COR, AER_NONFATAL, AER_FATAL,
+	SPEED_CUR, SPEED_MAX,
+	WIDTH_CUR, WIDTH_MAX,
+	FILES
+};
+
+// relative to /sys/bus/pci/devices/$pciId/
+static const char *file[] = {
+	"aer_dev_correctable", "aer_dev_nonfatal", "aer_dev_fatal",
+	"current_link_speed", "max_link_speed",
+	"current_link_width", "max_link_width"
+};
+
+static const char *label[] = {
+	"correctable", "nonfatal", "fatal",
+	"current", "max",
+	"current", "max"
+};
+
+_Static_assert(sizeof(file)/sizeof(char *) == FILES, "file[] incomplete");
+_Static_assert(sizeof(label)/sizeof(char *) == FILES, "label[] incomplete");
+
+typedef struct pcifd_st {
+	int fd[FILES];
+} pcifd_t;
+
+static char *sysfs = NULL;
+
+void
+setSysfsRoot(const char *dir) {
+	free(sysfs);
+	sysfs = (dir == NULL) ? NULL : strdup(dir);
+}
+
+void
+closePCIeHealth(gpu_t *gpu) {
+	uint k;
+
+	if (gpu->pcifd == NULL)
+		return;
+	for (k = 0; k < FILES; k++) {
+		if (gpu->pcifd->fd[k] >= 0)
+			close(gpu->pcifd->fd[k]);
+	}
+	free(gpu->pcifd);
+	gpu->pcifd = NULL;
+}
+
+static bool
+openFiles(gpu_t *gpu) {
+	char path[1024];
+	uint k, n = 0;
+
+	if (gpu->pciId == NULL)
+		return false;
+	gpu->pcifd = malloc(sizeof(pcifd_t));
+	if (gpu->pcifd == NULL)
+		return false;
+	for (k = 0; k < FILES; k++) {
+		snprintf(path, sizeof(path), "%s/bus/pci/devices/%s/%s",
+			sysfs == NULL ? SYSFS_ROOT : sysfs, gpu->pciId, file[k]);
+		gpu->pcifd->fd[k] = open(path, O_RDONLY);
+		if (gpu->pcifd->fd[k] < 0)
+			PROM_DEBUG("Unable to open '%s'", path);
+		else
+			n++;
+	}
+	if (n == 0) {
+		closePCIeHealth(gpu);
+		return false;
+	}
+	return true;
+}
+
+static bool
+readFile(gpu_t *gpu, uint k, char *buf, size_t sz) {
+	ssize_t n;
+
+	if (gpu->pcifd->fd[k] < 0)
+		return false;
+	// sysfs re-generates the content on each read from offset 0
+	n = pread(gpu->pcifd->fd[k], buf, sz - 1, 0);
+	if (n <= 0)
+		return false;
+	buf[n] = '\0';
+	return true;
+}
+
+bool
+getPCIeHealth(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	size_t sz;
+	uint i, k;
+	char buf[MBUF_SZ], data[MBUF_SZ * 8], name[64], *s, *e;
+	unsigned long long val;
+	double speed;
+	bool free_sb = sb == NULL;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getPCIeHealth", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_PCIE_AER);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasPCIeHealth == -1)
+			continue;
+		if (gpu->pcifd == NULL && !openFiles(gpu)) {
+			PROM_DEBUG("gpu.hasPCIeHealth = -1", "");
+			gpu->hasPCIeHealth = -1;
+			continue;
+		}
+		gpu->hasPCIeHealth = 1;
+		for (k = AER_COR; k <= AER_FATAL; k++) {
+			if (!readFile(gpu, k, data, sizeof(data)))
+				continue;
+			// one "name count" tupel per line, finally TOTAL_ERR_*
+			for (s = data; *s != '\0'; s = (*e == '\0') ? e : e + 1) {
+				e = strchr(s, '\n');
+				if (e == NULL)
+					e = s + strlen(s);
+				if (sscanf(s, "%63s %llu", name, &val) != 2
+					|| strncmp(name, "TOTAL_", 6) == 0)
+				{
+					continue;
+				}
+				snprintf(buf, sizeof(buf), NVMEXM_PCIE_AER_N
+					"{gpu=\"%d\",severity=\"%s\",type=\"%s\",uuid=\"%s\"} %llu\n",
+					gpu->idx, label[k], name, gpu->uuid, val);
+				psb_add_str(sb, buf);
+			}
+		}
+	}
+
+	if (!compact)
+		addPromInfo(NVMEXM_PCIE_SPEED);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasPCIeHealth != 1)
+			continue;
+		for (k = SPEED_CUR; k <= SPEED_MAX; k++) {
+			// e.g. "16.0 GT/s PCIe" or "Unknown"
+			if (!readFile(gpu, k, data, sizeof(data)))
+				continue;
+			speed = strtod(data, &e);
+			if (e == data)
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_PCIE_SPEED_N
+				"{gpu=\"%d\",value=\"%s\",uuid=\"%s\"} %.1f\n",
+				gpu->idx, label[k], gpu->uuid, speed);
+			psb_add_str(sb, buf);
+		}
+	}
+
+	if (!compact)
+		addPromInfo(NVMEXM_PCIE_WIDTH);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasPCIeHealth != 1)
+			continue;
+		for (k = WIDTH_CUR; k <= WIDTH_MAX; k++) {
+			if (!readFile(gpu, k, data, sizeof(data)))
+				continue;
+			val = strtoull(data, &e, 10);
+			if (e == data)
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_PCIE_WIDTH_N
+				"{gpu=\"%d\",value=\"%s\",uuid=\"%s\"} %llu\n",
+				gpu->idx, label[k], gpu->uuid, val);
+			psb_add_str(sb, buf);
+		}
+	}
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file pcihealth.h
+ * PCIe AER error counters and link speed/width of GPUs as exposed by the
+ * kernel via sysfs.
+ */
+
+#ifndef NVMEX_PCIHEALTH_H
+#define NVMEX_PCIHEALTH_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The default sysfs mount point. */
+#define SYSFS_ROOT	"/sys"
+
+/**
+ * Set the directory, where sysfs is mounted. Must be called before the first
+ * collection.
+ * @param dir	the directory to use. If \c NULL , \c SYSFS_ROOT gets used.
+ */
+void setSysfsRoot(const char *dir);
+
+/**
+ * Get PCIe health metrics.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getPCIeHealth(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+/**
+ * Close all sysfs files opened for the given GPU.
+ * @param gpu	the GPU whose files should be closed.
+ */
+void closePCIeHealth(gpu_t *gpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_PCIHEALTH_H
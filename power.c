@@ -9,9 +9,407 @@
  * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
  */
 
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "power.h"
+#include "rcache.h"
+
+// number of samples per ring, must be a power of 2: >= 80 s at 100 Hz
+#define RING_SZ 8192
+
+enum { SRC_USAGE, SRC_INSTANT, SOURCES };
+
+static const char *source[] = { "usage", "instant" };
+
+// single producer (sampler thread), single consumer (scrape)
+typedef struct ring_st {
+	uint	val[RING_SZ];	//!< samples in mW
+	atomic_ulong	head;	//!< number of samples stored so far
+	unsigned long	tail;	//!< number of samples consumed so far
+	atomic_ullong	over;	//!< number of samples above the threshold
+} ring_t;
+
+typedef struct psampler_st {
+	gpu_t	*gpu;
+	pthread_t	thread;
+	bool	hasSource[SOURCES];
+	ring_t	ring[SOURCES];
+	uint	mean;		//!< mean usage in mW of the last window, 0 if none
+} psampler_t;
+
+typedef struct energy_st {
+	unsigned long long	raw;	//!< last energy counter value in mJ
+	double	total;		//!< mJ since start, survives driver reloads
+	double	window;		//!< mJ of the current window
+	struct timespec	ts;	//!< time of the last update
+	uint	mW;			//!< last power usage (if integrated)
+	bool	integrated;	//!< energy counter not available
+} energy_t;
+
+static struct {
+	psampler_t	*s;
+	uint	count;
+	atomic_bool	stop;
+	uint	hz;			//!< samples per second, 0 .. disabled
+	uint	mW;			//!< threshold in mW, if pct == 0
+	uint	pct;		//!< threshold in percent of the enforced power limit
+} pw = { .s = NULL, .count = 0, .hz = 0, .mW = 0, .pct = 0 };
+
+int
+setPowerSampling(const char *hz) {
+	char *end;
+	long n = strtol(hz, &end, 10);
+
+	if (*end != '\0' || end == hz || (n != 0 && (n < 10 || n > 100))) {
+		PROM_WARN("Invalid power sampling rate '%s'", hz);
+		return 1;
+	}
+	pw.hz = n;
+	return 0;
+}
+
+int
+setPowerThreshold(const char *val) {
+	char *end;
+	long n = strtol(val, &end, 10);
+
+	if (end == val || n < 0 || (*end == '%' && (n > 1000 || end[1] != '\0'))
+		|| (*end != '%' && *end != '\0'))
+	{
+		PROM_WARN("Invalid power threshold '%s'", val);
+		return 1;
+	}
+	if (*end == '%') {
+		pw.pct = n;
+		pw.mW = 0;
+	} else {
+		pw.pct = 0;
+		pw.mW = n;
+	}
+	return 0;
+}
+
+static void
+store(ring_t *r, uint mW, uint threshold) {
+	unsigned long h = atomic_load(&(r->head));
+
+	r->val[h & (RING_SZ - 1)] = mW;
+	atomic_store(&(r->head), h + 1);
+	if (threshold > 0 && mW > threshold)
+		atomic_fetch_add(&(r->over), 1);
+}
+
+static void *
+powerLoop(void *arg) {
+	psampler_t *s = arg;
+	nvmlReturn_t res;
+	nvmlFieldValue_t fval;
+	struct timespec ts;
+	uint mW, limit, threshold = pw.mW;
+	unsigned long n;
+	long period = 1000000000L / pw.hz;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (n = 0; !atomic_load(&(pw.stop)); n++) {
+		if (pw.pct > 0 && (n % pw.hz) == 0) {
+			// the limit may get changed anytime
+			res = nvmlDeviceGetEnforcedPowerLimit(s->gpu->dev, &limit);
+			if (NVML_SUCCESS == res)
+				threshold = limit / 100 * pw.pct;
+		}
+		if (s->hasSource[SRC_USAGE]) {
+			res = nvmlDeviceGetPowerUsage(s->gpu->dev, &mW);
+			if (NVML_SUCCESS == res)
+				store(&(s->ring[SRC_USAGE]), mW, threshold);
+		}
+#ifdef NVML_FI_DEV_POWER_INSTANT
+		if (s->hasSource[SRC_INSTANT]) {
+			memset(&fval, 0, sizeof(fval));
+			fval.fieldId = NVML_FI_DEV_POWER_INSTANT;
+			res = nvmlDeviceGetFieldValues(s->gpu->dev, 1, &fval);
+			if (NVML_SUCCESS == res && fval.nvmlReturn == NVML_SUCCESS)
+				store(&(s->ring[SRC_INSTANT]), fval.value.uiVal, threshold);
+		}
+#else
+		(void) fval;
+#endif
+		ts.tv_nsec += period;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec -= 1000000000L;
+			ts.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	return NULL;
+}
+
+uint
+startPowerSampler(uint devs, gpu_t devList[]) {
+	nvmlReturn_t res;
+	uint i, mW;
+	gpu_t *gpu;
+	psampler_t *s;
+
+	if (pw.hz == 0 || pw.s != NULL || devs == 0)
+		return pw.hz == 0 ? 0 : 1;
+	pw.s = calloc(devs, sizeof(psampler_t));
+	if (pw.s == NULL)
+		return 1;
+	atomic_store(&(pw.stop), false);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL)
+			continue;
+		s = &(pw.s[pw.count]);
+		res = nvmlDeviceGetPowerUsage(gpu->dev, &mW);
+		s->hasSource[SRC_USAGE] = NVML_SUCCESS == res;
+#ifdef NVML_FI_DEV_POWER_INSTANT
+		nvmlFieldValue_t fval;
+
+		memset(&fval, 0, sizeof(fval));
+		fval.fieldId = NVML_FI_DEV_POWER_INSTANT;
+		res = nvmlDeviceGetFieldValues(gpu->dev, 1, &fval);
+		s->hasSource[SRC_INSTANT] = NVML_SUCCESS == res
+			&& fval.nvmlReturn == NVML_SUCCESS;
+#endif
+		if (!s->hasSource[SRC_USAGE] && !s->hasSource[SRC_INSTANT])
+			continue;
+		s->gpu = gpu;
+		if (pthread_create(&(s->thread), NULL, powerLoop, s) != 0) {
+			PROM_WARN("Unable to start power sampler for GPU %u", gpu->idx);
+			memset(s, 0, sizeof(psampler_t));
+			continue;
+		}
+		pw.count++;
+	}
+	PROM_DEBUG("%u power sampler started (%u Hz)", pw.count, pw.hz);
+	return 0;
+}
+
+void
+stopPowerSampler(void) {
+	uint i;
+
+	if (pw.s == NULL)
+		return;
+	atomic_store(&(pw.stop), true);
+	for (i = 0; i < pw.count; i++)
+		pthread_join(pw.s[i].thread, NULL);
+	free(pw.s);
+	pw.s = NULL;
+	pw.count = 0;
+}
+
+static int
+cmpuint(const void *a, const void *b) {
+	uint x = *((const uint *) a), y = *((const uint *) b);
+
+	return (x > y) - (x < y);
+}
+
+// min, max, mean and p99 of all samples since the last call
+static void
+addWindow(psb_t *sb, psampler_t *s, uint k, uint *tmp) {
+	ring_t *r = &(s->ring[k]);
+	unsigned long h = atomic_load(&(r->head));
+	unsigned long n = h - r->tail, i;
+	unsigned long long sum = 0;
+	char buf[MBUF_SZ];
+	uint v;
+
+	// keep 1 s distance to the producer - it might overwrite meanwhile
+	if (n > RING_SZ - pw.hz)
+		n = RING_SZ - pw.hz;
+	r->tail = h;
+	if (k == SRC_USAGE)
+		s->mean = 0;
+	if (n == 0)
+		return;
+	for (i = 0; i < n; i++) {
+		v = r->val[(h - n + i) & (RING_SZ - 1)];
+		tmp[i] = v;
+		sum += v;
+	}
+	if (k == SRC_USAGE)
+		s->mean = sum / n;
+	qsort(tmp, n, sizeof(uint), cmpuint);
+	snprintf(buf, sizeof(buf), NVMEXM_POWER_WINDOW_N
+		"{gpu=\"%d\",source=\"%s\",value=\"min\",uuid=\"%s\"} %u\n"
+		NVMEXM_POWER_WINDOW_N
+		"{gpu=\"%d\",source=\"%s\",value=\"max\",uuid=\"%s\"} %u\n",
+		s->gpu->idx, source[k], s->gpu->uuid, tmp[0],
+		s->gpu->idx, source[k], s->gpu->uuid, tmp[n - 1]);
+	psb_add_str(sb, buf);
+	snprintf(buf, sizeof(buf), NVMEXM_POWER_WINDOW_N
+		"{gpu=\"%d\",source=\"%s\",value=\"mean\",uuid=\"%s\"} %llu\n"
+		NVMEXM_POWER_WINDOW_N
+		"{gpu=\"%d\",source=\"%s\",value=\"p99\",uuid=\"%s\"} %u\n",
+		s->gpu->idx, source[k], s->gpu->uuid, sum / n,
+		s->gpu->idx, source[k], s->gpu->uuid, tmp[(n * 99 + 99) / 100 - 1]);
+	psb_add_str(sb, buf);
+}
+
+static void
+getPowerWindows(psb_t *sb, bool compact) {
+	uint i, k, *tmp;
+	char buf[MBUF_SZ];
+	psampler_t *s;
+
+	tmp = malloc(sizeof(uint) * RING_SZ);
+	if (tmp == NULL)
+		return;
+	if (!compact)
+		addPromInfo(NVMEXM_POWER_WINDOW);
+	for (i = 0; i < pw.count; i++) {
+		for (k = 0; k < SOURCES; k++) {
+			if (pw.s[i].hasSource[k])
+				addWindow(sb, &(pw.s[i]), k, tmp);
+		}
+	}
+	free(tmp);
+
+	if (pw.mW == 0 && pw.pct == 0)
+		return;
+	if (!compact)
+		addPromInfo(NVMEXM_POWER_OVER);
+	for (i = 0; i < pw.count; i++) {
+		s = &(pw.s[i]);
+		for (k = 0; k < SOURCES; k++) {
+			if (!s->hasSource[k])
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_POWER_OVER_N
+				"{gpu=\"%d\",source=\"%s\",uuid=\"%s\"} %llu\n",
+				s->gpu->idx, source[k], s->gpu->uuid,
+				atomic_load(&(s->ring[k].over)));
+			psb_add_str(sb, buf);
+		}
+	}
+}
+
+void
+freeEnergy(gpu_t *gpu) {
+	free(gpu->energy);
+	gpu->energy = NULL;
+}
+
+// mean power usage of the last sampler window, 0 if not available
+static uint
+samplerMean(gpu_t *gpu) {
+	uint i;
+
+	for (i = 0; i < pw.count; i++) {
+		if (pw.s[i].gpu == gpu)
+			return pw.s[i].mean;
+	}
+	return 0;
+}
+
+/*
+ * Update the energy consumed by the given GPU. Prefer the driver's energy
+ * counter, and start over from 0 if it went backwards (driver reload). Without
+ * it integrate the power usage: the mean of the sampler window if available,
+ * otherwise the trapezoid between the last and the current usage.
+ * Returns false if neither the counter nor the power usage is available.
+ */
+static bool
+updateEnergy(gpu_t *gpu, struct timespec *now, double *dt) {
+	nvmlReturn_t res;
+	energy_t *e = gpu->energy;
+	unsigned long long mj;
+	double delta;
+	uint mW;
+
+	*dt = 0;
+	if (e == NULL) {
+		e = gpu->energy = calloc(1, sizeof(energy_t));
+		if (e == NULL)
+			return false;
+	} else {
+		*dt = (now->tv_sec - e->ts.tv_sec)
+			+ (now->tv_nsec - e->ts.tv_nsec) / 1e9;
+	}
+	if (!e->integrated) {
+		res = nvmlDeviceGetTotalEnergyConsumption(gpu->dev, &mj);
+		if (NVML_SUCCESS == res) {
+			if (*dt > 0) {
+				if (mj < e->raw) {
+					PROM_INFO("GPU %u: energy counter reset (%llu < %llu)",
+						gpu->idx, mj, e->raw);
+					delta = mj;
+				} else {
+					delta = mj - e->raw;
+				}
+				e->total += delta;
+				e->window = delta;
+			}
+			e->raw = mj;
+			e->ts = *now;
+			return true;
+		}
+		if (!NOT_AVAIL(res))
+			return false;
+		PROM_DEBUG("GPU %u: integrating power usage", gpu->idx);
+		e->integrated = true;
+		*dt = 0;
+	}
+	if (gpu->hasPower == -1)
+		return false;
+	res = nvmlDeviceGetPowerUsage(gpu->dev, &mW);
+	if (NVML_SUCCESS != res)
+		return false;
+	if (*dt > 0) {
+		delta = samplerMean(gpu);
+		if (delta == 0)
+			delta = (e->mW + mW) / 2.0;
+		delta *= *dt;
+		e->total += delta;
+		e->window = delta;
+	}
+	e->mW = mW;
+	e->ts = *now;
+	return true;
+}
+
+static void
+getEnergy(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	struct timespec now;
+	gpu_t *gpu;
+	uint i;
+	double dt;
+	char buf[MBUF_SZ];
+	psb_t *sba = psb_new();
+
+	if (sba == NULL)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!compact)
+		addPromInfo(NVMEXM_ENERGY);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || !updateEnergy(gpu, &now, &dt))
+			continue;
+		snprintf(buf, sizeof(buf), NVMEXM_ENERGY_N
+			"{gpu=\"%d\",source=\"%s\",uuid=\"%s\"} %.3f\n",
+			gpu->idx, gpu->energy->integrated ? "integrated" : "counter",
+			gpu->uuid, gpu->energy->total / 1000);
+		psb_add_str(sb, buf);
+		// nothing to average on the first call
+		if (dt <= 0)
+			continue;
+		snprintf(buf, sizeof(buf), NVMEXM_POWER_AVG_N
+			"{gpu=\"%d\",uuid=\"%s\"} %.0f\n",
+			gpu->idx, gpu->uuid, gpu->energy->window / dt);
+		psb_add_str(sba, buf);
+	}
+	if (!compact)
+		addPromInfo(NVMEXM_POWER_AVG);
+	psb_add_str(sb, psb_str(sba));
+	psb_destroy(sba);
+}
 
 static void
 setLimits(gpu_t *gpu) {
@@ -24,7 +422,7 @@ setLimits(gpu_t *gpu) {
 	// power limit when booting
 	res = nvmlDeviceGetPowerManagementDefaultLimit(gpu->dev, &limit);
 	if (NVML_SUCCESS == res) {
-		snprintf(buf, sizeof(buf), NVMEXM_POWER_N
+		len = snprintf(buf, sizeof(buf), NVMEXM_POWER_N
 			"{gpu=\"%d\",limit=\"default\",uuid=\"%s\"} %u\n",
 			gpu->idx, gpu->uuid, limit);
 	} else {
@@ -46,6 +444,25 @@ setLimits(gpu_t *gpu) {
 	gpu->powerlimits = strdup(buf);
 }
 
+bool
+getPowerLimits(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	uint i;
+	size_t sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_POWER);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasPowerLimit == -1)
+			continue;
+		if (gpu->powerlimits == NULL)
+			setLimits(gpu);
+		psb_add_str(sb, gpu->powerlimits);
+	}
+	return psb_len(sb) != sz;
+}
+
 bool
 getPower(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	nvmlReturn_t res;
@@ -74,7 +491,7 @@ getPower(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		if (NVML_SUCCESS == res) {
 			snprintf(buf, sizeof(buf),
 				NVMEXM_POWER_CONSUM_N "{gpu=\"%d\",uuid=\"%s\"} %lld\n",
-				i, gpu->uuid, mj);
+				gpu->idx, gpu->uuid, mj);
 			psb_add_str(sb, buf);
 			gpu->hasPowerConsum = 1;
 		} else if (NOT_AVAIL(res)) {
@@ -92,10 +509,9 @@ getPower(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			continue;
 		res = nvmlDeviceGetPerformanceState(gpu->dev, &state);
 		if (NVML_SUCCESS == res) {
-			snprintf(buf, sizeof(buf),
+			psb_add_str(sb, rcRender(gpu, RC_PSTATE, state,
 				NVMEXM_PSTATE_N "{gpu=\"%d\",uuid=\"%s\"} %d\n",
-				i, gpu->uuid, state);
-			psb_add_str(sb, buf);
+				gpu->idx, gpu->uuid, state));
 			gpu->hasPstate = 1;
 		} else if (NOT_AVAIL(res)) {
 			PROM_DEBUG("gpu.hasPstate = -1", "");
@@ -114,7 +530,7 @@ getPower(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			if (NVML_SUCCESS == res) {
 				snprintf(buf, sizeof(buf),
 					NVMEXM_POWER_N"{gpu=\"%d\",usage=\"now\",uuid=\"%s\"} %u\n",
-					i, gpu->uuid, power);
+					gpu->idx, gpu->uuid, power);
 				psb_add_str(sb, buf);
 				gpu->hasPower = 1;
 			} else if (NOT_AVAIL(res)) {
@@ -126,34 +542,41 @@ getPower(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			// final decision
 			res = nvmlDeviceGetEnforcedPowerLimit(gpu->dev, &power);
 			if (NVML_SUCCESS == res) {
-				snprintf(buf, sizeof(buf), NVMEXM_POWER_N
+				psb_add_str(sb, rcRender(gpu, RC_POWER_ENFORCED, power,
+					NVMEXM_POWER_N
 					"{gpu=\"%d\",limit=\"enforced\",uuid=\"%s\"} %u\n",
-					i, gpu->uuid, power);
-				psb_add_str(sb, buf);
+					gpu->idx, gpu->uuid, power));
 			} else if (NOT_AVAIL(res)) {
 				PROM_DEBUG("No %s{gpu=\"%d\",limit=\"enforced\"}",
-					NVMEXM_POWER_N, i);
+					NVMEXM_POWER_N, gpu->idx);
 			}
 			// when  power management algorithm kicks in - settable, so static
 			// but not really.
 			res = nvmlDeviceGetPowerManagementLimit(gpu->dev, &power);
 			if (NVML_SUCCESS == res) {
-				snprintf(buf, sizeof(buf), NVMEXM_POWER_N
+				psb_add_str(sb, rcRender(gpu, RC_POWER_THROTTLE, power,
+					NVMEXM_POWER_N
 					"{gpu=\"%d\",limit=\"throttle\",uuid=\"%s\"} %u\n",
-					i, gpu->uuid, power);
-				psb_add_str(sb, buf);
+					gpu->idx, gpu->uuid, power));
 				gpu->hasPowerLimit = 1;
 			} else {
 				PROM_DEBUG("No %s{gpu=\"%d\",limit=\"throttle\"}",
 					NVMEXM_POWER_N, gpu->idx);
 				gpu->hasPowerLimit = -1;
 			}
+			if (skipStatic)
+				continue;
 			if (gpu->powerlimits == NULL)
 				setLimits(gpu);
 			psb_add_str(sb, gpu->powerlimits);
 		}
 	}
 
+	if (pw.count > 0)
+		getPowerWindows(sb, compact);
+	// after the windows: may use their mean
+	getEnergy(sb, compact, devs, devList);
+
 	sz = psb_len(sb) - sz;
 	if (free_sb) {
 		fprintf(stdout, "\n%s", psb_str(sb));
@@ -25,7 +25,9 @@ extern "C" {
 #endif
 
 /**
- * Get power related metrics.
+ * Get power related metrics. The average power usage and the sampler window
+ * cover the time since the previous call, which starts a new period. So
+ * concurrent requesters share the period instead of getting one each.
  * @param sb	where to append the metrics.
  * @param compact	If \c true do not add prom descriptions and type comments.
  * @param devs	number of devices in \c devList.
@@ -34,6 +36,54 @@ extern "C" {
  */
 bool getPower(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
 
+/**
+ * Set the rate of the background power sampler.
+ * @param hz	samples per second: \c 0 (disabled, the default) or
+ *	\c 10 .. \c 100 .
+ * @return \c 0 on success, \c 1 if the given value is invalid.
+ */
+int setPowerSampling(const char *hz);
+
+/**
+ * Set the threshold of the background power sampler.
+ * @param val	either a number of milliwatts, or a number followed by a
+ *	\c % , i.e. a percentage of the enforced power limit of the GPU.
+ * @return \c 0 on success, \c 1 if the given value is invalid.
+ */
+int setPowerThreshold(const char *val);
+
+/**
+ * Start a background thread per device, which samples its power usage (and
+ * the instantaneous power usage if available) with the rate set via
+ * \c setPowerSampling() . Does nothing if sampling is disabled.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to sample. Must not be \c NULL and must
+ *	stay valid until \c stopPowerSampler() got called!
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+uint startPowerSampler(uint devs, gpu_t devList[]);
+
+/**
+ * Stop all power sampler threads and release related resources.
+ */
+void stopPowerSampler(void);
+
+/**
+ * Free the energy integration state of the given GPU.
+ * @param gpu	the GPU whose state should be freed.
+ */
+void freeEnergy(gpu_t *gpu);
+
+/**
+ * Get power limit (default, min, max) metrics, only.
+ * @param sb	where to append the metrics. Must not be \c NULL !
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getPowerLimits(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
 #ifdef __cplusplus
 }
 #endif
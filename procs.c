@@ -0,0 +1,630 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procs.h"
+
+#ifndef NVML_VALUE_NOT_AVAILABLE
+#define NVML_VALUE_NOT_AVAILABLE (-1)
+#endif
+
+#define CG_TYPE_SZ 16
+#define CG_ID_SZ 128
+// seconds a cgroup gets kept after its last process left the GPU
+#define CG_KEEP 3600
+// number of processes per GPU reported by the procutil collector, the
+// utilization of all others gets summed up as pid "other"
+#define PROC_TOPK 10
+
+enum { ENG_SM, ENG_MEM, ENG_ENC, ENG_DEC, ENGINES };
+
+static const char *engine[] = { "sm", "memory", "encoder", "decoder" };
+
+// a process seen on a GPU
+typedef struct pidc_st {
+	uint	pid;
+	unsigned long long	start;	//!< start time in clock ticks since boot
+	uint	gen;			//!< last scrape the process was seen
+	char	type[CG_TYPE_SZ];
+	char	id[CG_ID_SZ];
+} pidc_t;
+
+// usage of a GPU by a cgroup
+typedef struct cgrp_st {
+	gpu_t	*gpu;
+	char	type[CG_TYPE_SZ];
+	char	id[CG_ID_SZ];
+	unsigned long long	mem;	//!< GPU memory used in bytes (current scrape)
+	uint	procs;			//!< number of processes (current scrape)
+	double	seconds;		//!< accumulated time on the GPU
+	time_t	last;			//!< monotonic time of the last use
+} cgrp_t;
+
+// utilization of a process summed up over all samples of the current window
+typedef struct putil_st {
+	uint	pid;
+	uint	n;				//!< number of samples
+	uint	util[ENGINES];	//!< sum, replaced by the mean when done
+} putil_t;
+
+static struct {
+	pidc_t	*pids;
+	uint	npids;
+	uint	maxpids;
+	cgrp_t	*cgs;
+	uint	ncgs;
+	uint	maxcgs;
+	nvmlProcessInfo_t	*pinfo;
+	uint	maxpinfo;
+	nvmlProcessUtilizationSample_t	*usamples;
+	uint	maxusamples;
+	putil_t	*putil;
+	uint	maxputil;
+	uint	gen;
+	struct timespec	ts;	//!< time of the last scrape
+} pc = { .pids = NULL, .cgs = NULL, .pinfo = NULL };
+
+void
+freeProcs(void) {
+	free(pc.pids);
+	free(pc.cgs);
+	free(pc.pinfo);
+	free(pc.usamples);
+	free(pc.putil);
+	memset(&pc, 0, sizeof(pc));
+}
+
+static bool
+grow(void **a, uint *max, uint min, size_t sz) {
+	void *p;
+	uint n = min + 16;
+
+	if (*max >= min)
+		return true;
+	p = realloc(*a, n * sz);
+	if (p == NULL)
+		return false;
+	*a = p;
+	*max = n;
+	return true;
+}
+
+static ssize_t
+readProc(uint pid, const char *file, char *buf, size_t sz) {
+	char path[64];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), PROC_ROOT "/%u/%s", pid, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, sz - 1);
+	close(fd);
+	if (n >= 0)
+		buf[n] = '\0';
+	return n;
+}
+
+// field 22 of /proc/$pid/stat, 0 if the process is gone
+static unsigned long long
+startTime(uint pid) {
+	char buf[1024], *s;
+	uint k;
+
+	if (readProc(pid, "stat", buf, sizeof(buf)) <= 0)
+		return 0;
+	// comm may contain blanks and parens
+	s = strrchr(buf, ')');
+	for (k = 0; k < 20 && s != NULL; k++)
+		s = strchr(s + 1, ' ');
+	return (s == NULL) ? 0 : strtoull(s + 1, NULL, 10);
+}
+
+static void
+copyId(char *id, const char *s, size_t len) {
+	size_t i;
+
+	if (len >= CG_ID_SZ)
+		len = CG_ID_SZ - 1;
+	for (i = 0; i < len; i++)
+		id[i] = (s[i] == '"' || s[i] == '\\' || s[i] == '\n') ? '_' : s[i];
+	id[len] = '\0';
+}
+
+/*
+ * Slurm: .../job_$id/...
+ * Kubernetes: .../pod$uid/... or .../kubepods-$qos-pod$uid.slice/...
+ * systemd: the innermost *.service or *.scope
+ */
+static void
+classify(const char *path, char *type, char *id) {
+	const char *s, *e, *unit = NULL;
+	size_t len = 0;
+	char *t;
+
+	if ((s = strstr(path, "/job_")) != NULL) {
+		s += 5;
+		strcpy(type, "slurm");
+		copyId(id, s, strcspn(s, "/"));
+		return;
+	}
+	if (strstr(path, "kubepods") != NULL) {
+		for (s = strstr(path, "pod"); s != NULL; s = strstr(s + 3, "pod")) {
+			if (s > path && (s[-1] == '/' || s[-1] == '-')
+				&& s[3] != 's' && s[3] != '\0')
+			{
+				break;
+			}
+		}
+		if (s != NULL) {
+			s += 3;
+			strcpy(type, "k8s");
+			len = strcspn(s, "/");
+			e = strstr(s, ".slice");
+			if (e != NULL && (size_t) (e - s) < len)
+				len = e - s;
+			copyId(id, s, len);
+			// systemd cgroup driver replaces '-' by '_'
+			for (t = id; *t != '\0'; t++) {
+				if (*t == '_')
+					*t = '-';
+			}
+			return;
+		}
+	}
+	for (s = path; *s != '\0'; s = (*e == '\0') ? e : e + 1) {
+		e = s + strcspn(s, "/");
+		if ((e - s > 8 && strncmp(e - 8, ".service", 8) == 0)
+			|| (e - s > 6 && strncmp(e - 6, ".scope", 6) == 0))
+		{
+			unit = s;
+			len = e - s;
+		}
+	}
+	if (unit != NULL) {
+		strcpy(type, "systemd");
+		copyId(id, unit, len);
+		return;
+	}
+	strcpy(type, "other");
+	copyId(id, path, strlen(path));
+}
+
+/*
+ * Prefer the v1 memory hierarchy (Slurm and kubelet account there), then the
+ * unified (v2) hierarchy, and finally whatever comes first.
+ */
+static void
+setCgroup(pidc_t *p) {
+	char buf[4096], *s, *e, *c, *path = NULL;
+	int prio = 0, pr;
+
+	strcpy(p->type, "other");
+	strcpy(p->id, "unknown");
+	if (readProc(p->pid, "cgroup", buf, sizeof(buf)) <= 0)
+		return;
+	// hierarchy-ID:controller-list:cgroup-path
+	for (s = buf; *s != '\0'; s = e + 1) {
+		e = strchr(s, '\n');
+		if (e == NULL)
+			e = s + strlen(s);
+		c = memchr(s, ':', e - s);
+		if (c == NULL || (c = memchr(c + 1, ':', e - c - 1)) == NULL)
+			goto next;
+		*c = '\0';
+		if (strstr(s, ":memory") != NULL || strstr(s, ",memory") != NULL)
+			pr = 3;
+		else if (strcmp(s, "0:") == 0)
+			pr = 2;
+		else
+			pr = 1;
+		if (pr > prio) {
+			prio = pr;
+			path = c + 1;
+		}
+next:
+		if (*e == '\0')
+			break;
+		*e = '\0';
+	}
+	if (path != NULL)
+		classify(path, p->type, p->id);
+}
+
+/*
+ * Get the cache entry of the given process. A PID found in the cache is the
+ * same process only if its start time did not change. Returns NULL if the
+ * process is gone.
+ */
+static pidc_t *
+lookupPid(uint pid) {
+	unsigned long long start = startTime(pid);
+	pidc_t *p;
+	uint i;
+
+	if (start == 0)
+		return NULL;
+	for (i = 0; i < pc.npids; i++) {
+		p = &(pc.pids[i]);
+		if (p->pid != pid)
+			continue;
+		if (p->start != start) {
+			p->start = start;
+			setCgroup(p);
+		}
+		p->gen = pc.gen;
+		return p;
+	}
+	if (!grow((void **) &(pc.pids), &(pc.maxpids), pc.npids + 1,
+		sizeof(pidc_t)))
+	{
+		return NULL;
+	}
+	p = &(pc.pids[pc.npids++]);
+	p->pid = pid;
+	p->start = start;
+	p->gen = pc.gen;
+	setCgroup(p);
+	PROM_DEBUG("PID %u: %s %s", pid, p->type, p->id);
+	return p;
+}
+
+static cgrp_t *
+lookupCgroup(gpu_t *gpu, pidc_t *p) {
+	cgrp_t *cg;
+	uint i;
+
+	for (i = 0; i < pc.ncgs; i++) {
+		cg = &(pc.cgs[i]);
+		if (cg->gpu == gpu && strcmp(cg->id, p->id) == 0
+			&& strcmp(cg->type, p->type) == 0)
+		{
+			return cg;
+		}
+	}
+	if (!grow((void **) &(pc.cgs), &(pc.maxcgs), pc.ncgs + 1, sizeof(cgrp_t)))
+		return NULL;
+	cg = &(pc.cgs[pc.ncgs++]);
+	memset(cg, 0, sizeof(cgrp_t));
+	cg->gpu = gpu;
+	strcpy(cg->type, p->type);
+	strcpy(cg->id, p->id);
+	return cg;
+}
+
+// append the processes of the given kind to pc.pinfo[off], -1 if n/a
+static int
+fetch(gpu_t *gpu, bool graphics, uint off) {
+	nvmlReturn_t res;
+	nvmlProcessInfo_t *p;
+	uint n;
+
+	for (;;) {
+		if (!grow((void **) &(pc.pinfo), &(pc.maxpinfo), off + 16,
+			sizeof(nvmlProcessInfo_t)))
+		{
+			return 0;
+		}
+		n = pc.maxpinfo - off;
+		p = pc.pinfo + off;
+		res = graphics
+			? nvmlDeviceGetGraphicsRunningProcesses(gpu->dev, &n, p)
+			: nvmlDeviceGetComputeRunningProcesses(gpu->dev, &n, p);
+		if (res != NVML_ERROR_INSUFFICIENT_SIZE)
+			break;
+		// processes may get started meanwhile
+		if (!grow((void **) &(pc.pinfo), &(pc.maxpinfo), off + n + 16,
+			sizeof(nvmlProcessInfo_t)))
+		{
+			return 0;
+		}
+	}
+	if (NVML_SUCCESS == res)
+		return n;
+	if (NOT_AVAIL(res))
+		return -1;
+	PROM_DEBUG("GPU %u: unable to get %s processes: %s", gpu->idx,
+		graphics ? "graphics" : "compute", nverror(res));
+	return 0;
+}
+
+static void
+scan(gpu_t *gpu, double dt, time_t now) {
+	int compute, graphics;
+	uint i, k, n;
+	unsigned long long mem;
+	pidc_t *p;
+	cgrp_t *cg;
+
+	compute = fetch(gpu, false, 0);
+	graphics = fetch(gpu, true, compute < 0 ? 0 : compute);
+	if (compute < 0 && graphics < 0) {
+		PROM_DEBUG("gpu.hasProcs = -1", "");
+		gpu->hasProcs = -1;
+		return;
+	}
+	gpu->hasProcs = 1;
+	if (compute < 0)
+		compute = 0;
+	n = compute + (graphics < 0 ? 0 : graphics);
+	for (i = 0; i < n; i++) {
+		// a process using compute and graphics is listed twice
+		for (k = 0; i >= (uint) compute && k < (uint) compute; k++) {
+			if (pc.pinfo[k].pid == pc.pinfo[i].pid)
+				break;
+		}
+		if (i >= (uint) compute && k < (uint) compute)
+			continue;
+		p = lookupPid(pc.pinfo[i].pid);
+		if (p == NULL)
+			continue;
+		cg = lookupCgroup(gpu, p);
+		if (cg == NULL)
+			continue;
+		mem = pc.pinfo[i].usedGpuMemory;
+		if (mem != (unsigned long long) NVML_VALUE_NOT_AVAILABLE)
+			cg->mem += mem;
+		// the GPU time since the last scrape
+		if (cg->procs++ == 0)
+			cg->seconds += dt;
+		cg->last = now;
+	}
+}
+
+/*
+ * Drop processes not seen during the last two collections (the process and
+ * the procutil collector share the cache) ...
+ */
+static void
+expirePids(void) {
+	uint i;
+
+	for (i = 0; i < pc.npids; ) {
+		if (pc.gen - pc.pids[i].gen > 1)
+			pc.pids[i] = pc.pids[--pc.npids];
+		else
+			i++;
+	}
+}
+
+// ... and cgroups not seen for a while
+static void
+expire(time_t now) {
+	uint i;
+
+	expirePids();
+	for (i = 0; i < pc.ncgs; ) {
+		if (now - pc.cgs[i].last > CG_KEEP)
+			pc.cgs[i] = pc.cgs[--pc.ncgs];
+		else
+			i++;
+	}
+}
+
+bool
+getProcs(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	struct timespec ts;
+	gpu_t *gpu;
+	cgrp_t *cg;
+	size_t sz;
+	uint i, k;
+	double dt = 0;
+	char buf[MBUF_SZ * 2];
+	bool free_sb = sb == NULL;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getProcs", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (pc.ts.tv_sec != 0)
+		dt = (ts.tv_sec - pc.ts.tv_sec) + (ts.tv_nsec - pc.ts.tv_nsec) / 1e9;
+	pc.ts = ts;
+	pc.gen++;
+	for (k = 0; k < pc.ncgs; k++) {
+		pc.cgs[k].mem = 0;
+		pc.cgs[k].procs = 0;
+	}
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev != NULL && gpu->hasProcs != -1)
+			scan(gpu, dt, ts.tv_sec);
+	}
+	expire(ts.tv_sec);
+
+	if (!compact)
+		addPromInfo(NVMEXM_CGROUP_MEM);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		for (k = 0; k < pc.ncgs; k++) {
+			cg = &(pc.cgs[k]);
+			if (cg->gpu != gpu || cg->procs == 0)
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_CGROUP_MEM_N
+				"{gpu=\"%d\",type=\"%s\",id=\"%s\",uuid=\"%s\"} %llu\n",
+				gpu->idx, cg->type, cg->id, gpu->uuid, cg->mem);
+			psb_add_str(sb, buf);
+		}
+	}
+
+	if (!compact)
+		addPromInfo(NVMEXM_CGROUP_TIME);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		for (k = 0; k < pc.ncgs; k++) {
+			cg = &(pc.cgs[k]);
+			if (cg->gpu != gpu)
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_CGROUP_TIME_N
+				"{gpu=\"%d\",type=\"%s\",id=\"%s\",uuid=\"%s\"} %.3f\n",
+				gpu->idx, cg->type, cg->id, gpu->uuid, cg->seconds);
+			psb_add_str(sb, buf);
+		}
+	}
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
+
+// fetch all samples since the last call and sum them up per process
+static uint
+sumProcUtil(gpu_t *gpu) {
+	nvmlReturn_t res;
+	nvmlProcessUtilizationSample_t *u;
+	putil_t *pu;
+	uint i, k, n = 0, count = 0;
+	unsigned long long last = gpu->procUtilTs;
+
+	res = nvmlDeviceGetProcessUtilization(gpu->dev, NULL, &n, last);
+	if (NOT_AVAIL(res)) {
+		PROM_DEBUG("gpu.hasProcUtil = -1", "");
+		gpu->hasProcUtil = -1;
+		return 0;
+	}
+	gpu->hasProcUtil = 1;
+	// NVML_ERROR_NOT_FOUND: no samples since last
+	if ((NVML_SUCCESS != res && NVML_ERROR_INSUFFICIENT_SIZE != res) || n == 0)
+		return 0;
+	// some slack for samples taken meanwhile
+	n += 8;
+	if (!grow((void **) &(pc.usamples), &(pc.maxusamples), n,
+		sizeof(nvmlProcessUtilizationSample_t))
+		|| !grow((void **) &(pc.putil), &(pc.maxputil), n, sizeof(putil_t)))
+	{
+		return 0;
+	}
+	res = nvmlDeviceGetProcessUtilization(gpu->dev, pc.usamples, &n, last);
+	if (NVML_SUCCESS != res)
+		return 0;
+	for (i = 0; i < n; i++) {
+		u = &(pc.usamples[i]);
+		if (u->timeStamp <= last)
+			continue;
+		if (u->timeStamp > gpu->procUtilTs)
+			gpu->procUtilTs = u->timeStamp;
+		for (k = 0; k < count && pc.putil[k].pid != u->pid; k++)
+			;
+		pu = &(pc.putil[k]);
+		if (k == count) {
+			memset(pu, 0, sizeof(putil_t));
+			pu->pid = u->pid;
+			count++;
+		}
+		pu->n++;
+		pu->util[ENG_SM] += u->smUtil;
+		pu->util[ENG_MEM] += u->memUtil;
+		pu->util[ENG_ENC] += u->encUtil;
+		pu->util[ENG_DEC] += u->decUtil;
+	}
+	for (i = 0; i < count; i++) {
+		for (k = 0; k < ENGINES; k++)
+			pc.putil[i].util[k] /= pc.putil[i].n;
+	}
+	return count;
+}
+
+// busiest first: SM, then memory, then encoder + decoder
+static int
+cmputil(const void *a, const void *b) {
+	const putil_t *x = a, *y = b;
+
+	if (x->util[ENG_SM] != y->util[ENG_SM])
+		return (x->util[ENG_SM] < y->util[ENG_SM]) ? 1 : -1;
+	if (x->util[ENG_MEM] != y->util[ENG_MEM])
+		return (x->util[ENG_MEM] < y->util[ENG_MEM]) ? 1 : -1;
+	return (int) (y->util[ENG_ENC] + y->util[ENG_DEC])
+		- (int) (x->util[ENG_ENC] + x->util[ENG_DEC]);
+}
+
+bool
+getProcUtil(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	pidc_t *p;
+	size_t sz;
+	uint i, k, e, n, shown, rest, other[ENGINES];
+	char buf[MBUF_SZ * 2];
+	bool free_sb = sb == NULL;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getProcUtil", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	pc.gen++;
+	if (!compact)
+		addPromInfo(NVMEXM_PROC_UTIL);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasProcUtil == -1)
+			continue;
+		n = sumProcUtil(gpu);
+		if (n == 0)
+			continue;
+		qsort(pc.putil, n, sizeof(putil_t), cmputil);
+		memset(other, 0, sizeof(other));
+		shown = rest = 0;
+		for (k = 0; k < n; k++) {
+			// skip processes gone meanwhile
+			p = lookupPid(pc.putil[k].pid);
+			if (p == NULL)
+				continue;
+			if (shown == PROC_TOPK) {
+				rest++;
+				for (e = 0; e < ENGINES; e++)
+					other[e] += pc.putil[k].util[e];
+				continue;
+			}
+			shown++;
+			for (e = 0; e < ENGINES; e++) {
+				snprintf(buf, sizeof(buf), NVMEXM_PROC_UTIL_N "{gpu=\"%d\","
+					"pid=\"%u\",type=\"%s\",id=\"%s\",engine=\"%s\","
+					"uuid=\"%s\"} %u\n", gpu->idx, p->pid, p->type, p->id,
+					engine[e], gpu->uuid, pc.putil[k].util[e]);
+				psb_add_str(sb, buf);
+			}
+		}
+		// only if at least one process got left out
+		if (rest == 0)
+			continue;
+		for (e = 0; e < ENGINES; e++) {
+			snprintf(buf, sizeof(buf), NVMEXM_PROC_UTIL_N "{gpu=\"%d\","
+				"pid=\"other\",type=\"\",id=\"\",engine=\"%s\","
+				"uuid=\"%s\"} %u\n", gpu->idx, engine[e], gpu->uuid, other[e]);
+			psb_add_str(sb, buf);
+		}
+	}
+	expirePids();
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
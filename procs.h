@@ -0,0 +1,61 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file procs.h
+ * GPU memory and time of processes running on GPUs summed up per cgroup,
+ * i.e. Slurm job, Kubernetes pod or systemd unit, and the utilization of
+ * the busiest processes.
+ */
+
+#ifndef NVMEX_PROCS_H
+#define NVMEX_PROCS_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The default procfs mount point. */
+#define PROC_ROOT	"/proc"
+
+/**
+ * Get per cgroup GPU usage metrics.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getProcs(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+/**
+ * Get the SM, memory, encoder and decoder utilization of the busiest
+ * processes on each GPU since the last call, no matter who made it.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getProcUtil(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+/**
+ * Release all resources allocated by \c getProcs() and \c getProcUtil() .
+ */
+void freeProcs(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_PROCS_H
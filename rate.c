@@ -0,0 +1,69 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "rate.h"
+
+// min. number of seconds between two values to calculate a new rate
+#define MIN_INTERVAL 0.5
+
+typedef struct rate_st {
+	unsigned long long	val;	//!< reference value
+	struct timespec	ts;			//!< time the reference value got fed
+	double	rate;				//!< last calculated rate
+	bool	hasVal;				//!< val and ts are set
+	bool	hasRate;			//!< rate is set
+} rate_t;
+
+bool
+rtUpdate(gpu_t *gpu, rtslot_t slot, unsigned long long val, double *rate) {
+	struct timespec now;
+	rate_t *r;
+	double dt;
+	unsigned long long delta;
+
+	if (gpu->rates == NULL) {
+		gpu->rates = calloc(RT_MAX, sizeof(rate_t));
+		if (gpu->rates == NULL)
+			return false;
+	}
+	r = &(gpu->rates[slot]);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (r->hasVal) {
+		dt = (now.tv_sec - r->ts.tv_sec) + (now.tv_nsec - r->ts.tv_nsec) / 1e9;
+		if (dt < MIN_INTERVAL) {
+			*rate = r->rate;
+			return r->hasRate;
+		}
+		if (val < r->val) {
+			PROM_DEBUG("GPU %u: counter %u reset (%llu < %llu)", gpu->idx,
+				slot, val, r->val);
+			delta = val;
+		} else {
+			delta = val - r->val;
+		}
+		r->rate = delta / dt;
+		r->hasRate = true;
+	}
+	r->val = val;
+	r->ts = now;
+	r->hasVal = true;
+	*rate = r->rate;
+	return r->hasRate;
+}
+
+void
+rtFree(gpu_t *gpu) {
+	free(gpu->rates);
+	gpu->rates = NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file rate.h
+ * Per second rates of counters, calculated from the difference to the value
+ * seen on the previous collection, so that dashboards do not need to.
+ */
+
+#ifndef NVMEX_RATE_H
+#define NVMEX_RATE_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Counters per GPU, whose rate gets calculated. */
+typedef enum {
+	RT_PCIE_REPLAY,
+	RT_NVLINK_DATA_TX,
+	RT_NVLINK_DATA_RX,
+	RT_NVLINK_RAW_TX,
+	RT_NVLINK_RAW_RX,
+	RT_VIOL,
+	RT_MAX = RT_VIOL + NVML_PERF_POLICY_COUNT
+} rtslot_t;
+
+/**
+ * Feed the current value of the given counter and get its rate per second
+ * wrt. the value fed on the previous call. If the counter went backwards
+ * (e.g. driver reload or GPU reset), it is assumed to be restarted from 0.
+ * Calls within less than 0.5 s after the previous one do not change the
+ * reference value but just return the last rate.
+ * @param gpu	the GPU the counter belongs to.
+ * @param slot	the counter.
+ * @param val	the current value of the counter.
+ * @param rate	where to store the rate.
+ * @return \c true if \c rate got set, \c false otherwise (e.g. on the first
+ *	call).
+ */
+bool rtUpdate(gpu_t *gpu, rtslot_t slot, unsigned long long val,
+	double *rate);
+
+/**
+ * Free the rate state of the given GPU.
+ * @param gpu	the GPU whose state should be freed.
+ */
+void rtFree(gpu_t *gpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_RATE_H
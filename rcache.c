@@ -0,0 +1,70 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "rcache.h"
+
+typedef struct rline_st {
+	unsigned long long val;	//!< raw value of the cached line
+	bool	valid;			//!< line has been rendered at least once
+	char	line[MBUF_SZ];	//!< the prom formatted line
+} rline_t;
+
+static unsigned long long hits = 0;
+static unsigned long long misses = 0;
+
+char *
+rcRender(gpu_t *gpu, rcslot_t slot, unsigned long long val,
+	const char *fmt, ...)
+{
+	static char buf[MBUF_SZ];
+	rline_t *rl;
+	char *line = buf;
+	va_list ap;
+
+	if (gpu->rcache == NULL)
+		gpu->rcache = calloc(RC_MAX, sizeof(rline_t));
+	if (gpu->rcache != NULL) {
+		rl = &(gpu->rcache[slot]);
+		if (rl->valid && rl->val == val) {
+			hits++;
+			return rl->line;
+		}
+		rl->val = val;
+		rl->valid = true;
+		line = rl->line;
+	}
+	misses++;
+	va_start(ap, fmt);
+	vsnprintf(line, MBUF_SZ, fmt, ap);
+	va_end(ap);
+	return line;
+}
+
+void
+rcGetStats(psb_t *sb, bool compact) {
+	char buf[MBUF_SZ];
+
+	if (!compact)
+		addPromInfo(NVMEXM_RCACHE);
+	snprintf(buf, sizeof(buf), NVMEXM_RCACHE_N "{result=\"hit\"} %llu\n"
+		NVMEXM_RCACHE_N "{result=\"miss\"} %llu\n", hits, misses);
+	psb_add_str(sb, buf);
+}
+
+void
+rcFree(gpu_t *gpu) {
+	free(gpu->rcache);
+	gpu->rcache = NULL;
+}
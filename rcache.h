@@ -0,0 +1,81 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file rcache.h
+ * Render cache: keeps the last prom formatted line of a series per GPU, so
+ * that it needs to be rendered again only, if the related value changed.
+ */
+
+#ifndef NVMEX_RCACHE_H
+#define NVMEX_RCACHE_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of ECC error counter slots (see ecc.c). */
+#define RC_ECC_ERRS	26
+
+/** Cached series per GPU. */
+typedef enum {
+	RC_ECC_MODE_CURRENT,
+	RC_ECC_MODE_PENDING,
+	RC_ECC_ERR,
+	RC_ECC_PAGE_SBE = RC_ECC_ERR + RC_ECC_ERRS,
+	RC_ECC_PAGE_DBE,
+	RC_ECC_PAGE_PENDING,
+	RC_ECC_ROW_UNCORR,
+	RC_ECC_ROW_CORR,
+	RC_ECC_ROW_PENDING,
+	RC_ECC_ROW_FAILURE,
+	RC_PCIE_REPLAY,
+	RC_PSTATE,
+	RC_POWER_ENFORCED,
+	RC_POWER_THROTTLE,
+	RC_MAX
+} rcslot_t;
+
+/**
+ * Get the prom formatted line of the given series. If its value did not
+ * change since the last call, the cached line gets returned, otherwise it
+ * gets rendered using the given format and arguments and cached.
+ * @param gpu	the GPU the series belongs to.
+ * @param slot	the series.
+ * @param val	the raw value of the series.
+ * @param fmt	printf format to use to render the line incl. label values
+ *	and \c val .
+ * @return the rendered line. It is valid until the next call for the same
+ *	slot, only.
+ */
+char *rcRender(gpu_t *gpu, rcslot_t slot, unsigned long long val,
+	const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+/**
+ * Get render cache statistics.
+ * @param sb	where to append the metrics. Must not be \c NULL !
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ */
+void rcGetStats(psb_t *sb, bool compact);
+
+/**
+ * Free the render cache of the given GPU.
+ * @param gpu	the GPU whose cache should be freed.
+ */
+void rcFree(gpu_t *gpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_RCACHE_H
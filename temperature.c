@@ -69,6 +69,25 @@ setStaticValues(gpu_t *gpu) {
 	gpu->temperatures = strdup(buf);
 }
 
+bool
+getTemperatureThresholds(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	uint i;
+	size_t sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_TEMPERATURE);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasTemperature == -1)
+			continue;
+		if (gpu->temperatures == NULL)
+			setStaticValues(gpu);
+		psb_add_str(sb, gpu->temperatures);
+	}
+	return psb_len(sb) != sz;
+}
+
 bool
 getTemperatures(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	nvmlReturn_t res;
@@ -97,7 +116,7 @@ getTemperatures(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 		if (NVML_SUCCESS == res) {
 			snprintf(buf, sizeof(buf), NVMEXM_TEMPERATURE_N
 				"{gpu=\"%d\",device=\"gpu\",value=\"now\",uuid=\"%s\"} %u\n",
-				i, gpu->uuid, value);
+				gpu->idx, gpu->uuid, value);
 			psb_add_str(sb, buf);
 			gpu->hasTemperature = 1;
 		} else if (NOT_AVAIL(res)) {
@@ -112,7 +131,7 @@ getTemperatures(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 			if (NVML_SUCCESS == res && fval.value.uiVal != 0) {
 				snprintf(buf, sizeof(buf), NVMEXM_TEMPERATURE_N
 					"{gpu=\"%d\",device=\"mem\",uuid=\"%s\"} %u\n",
-					i, gpu->uuid, value);
+					gpu->idx, gpu->uuid, value);
 				psb_add_str(sb, buf);
 				gpu->hasTemperatureMem = 1;
 			} else if (NOT_AVAIL(res)) {
@@ -120,6 +139,8 @@ getTemperatures(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 				gpu->hasTemperature = -1;
 			}
 		}
+		if (skipStatic)
+			continue;
 		if (gpu->temperatures == NULL)
 			setStaticValues(gpu);
 		psb_add_str(sb, gpu->temperatures);
@@ -34,6 +34,16 @@ extern "C" {
  */
 bool getTemperatures(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
 
+/**
+ * Get temperature threshold metrics, only.
+ * @param sb	where to append the metrics. Must not be \c NULL !
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getTemperatureThresholds(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,265 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "throttle.h"
+
+static const struct {
+	unsigned long long	bit;
+	const char	*name;		//!< value of the reason label
+} reason[] = {
+	{ nvmlClocksThrottleReasonGpuIdle, "gpu_idle" },
+	{ nvmlClocksThrottleReasonApplicationsClocksSetting, "app_clocks" },
+	{ nvmlClocksThrottleReasonSwPowerCap, "sw_power_cap" },
+	{ nvmlClocksThrottleReasonHwSlowdown, "hw_slowdown" },
+	{ nvmlClocksThrottleReasonSyncBoost, "sync_boost" },
+#ifdef nvmlClocksThrottleReasonSwThermalSlowdown
+	{ nvmlClocksThrottleReasonSwThermalSlowdown, "sw_thermal" },
+	{ nvmlClocksThrottleReasonHwThermalSlowdown, "hw_thermal" },
+	{ nvmlClocksThrottleReasonHwPowerBrakeSlowdown, "hw_power_brake" },
+#endif
+#ifdef nvmlClocksThrottleReasonDisplayClockSetting
+	{ nvmlClocksThrottleReasonDisplayClockSetting, "display_clocks" },
+#endif
+	{ 0, "other" }		// all bits not mentioned above
+};
+#define REASONS (sizeof(reason)/sizeof(reason[0]))
+#define OTHER (REASONS - 1)
+
+typedef struct tsampler_st {
+	gpu_t	*gpu;
+	unsigned long long	supported;	//!< reasons the GPU may report
+	unsigned long long	last;		//!< reasons seen by the last sample
+	struct timespec	ts;				//!< time of the last sample
+	bool	valid;					//!< last and ts are set
+	unsigned long long	ns[REASONS];	//!< time spent per reason
+} tsampler_t;
+
+static struct {
+	tsampler_t	*s;
+	uint	count;
+	uint	hz;			//!< samples per second, 0 .. disabled
+	pthread_t	thread;
+	atomic_bool	stop;
+	pthread_mutex_t	lock;	//!< protects last, valid and ns of all samplers
+} th = { .s = NULL, .count = 0, .hz = 0, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+int
+setThrottleSampling(const char *hz) {
+	char *end;
+	long n = strtol(hz, &end, 10);
+
+	if (*end != '\0' || end == hz || n < 0 || n > 100) {
+		PROM_WARN("Invalid throttle sampling rate '%s'", hz);
+		return 1;
+	}
+	th.hz = n;
+	return 0;
+}
+
+// the reasons of the given bitmask as mask of reason[] indexes
+static uint
+reasonMask(unsigned long long bits) {
+	uint k, mask = 0;
+
+	for (k = 0; k < OTHER; k++) {
+		if (bits & reason[k].bit) {
+			mask |= 1U << k;
+			bits &= ~reason[k].bit;
+		}
+	}
+	if (bits != 0)
+		mask |= 1U << OTHER;
+	return mask;
+}
+
+/*
+ * Take a sample of the given GPU. The time elapsed since the previous sample
+ * gets accounted to the reasons seen by the previous sample.
+ */
+static void
+update(tsampler_t *s) {
+	nvmlReturn_t res;
+	unsigned long long reasons;
+	struct timespec now;
+	long long ns;
+	uint k, mask;
+
+	res = nvmlDeviceGetCurrentClocksThrottleReasons(s->gpu->dev, &reasons);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&(th.lock));
+	if (s->valid) {
+		ns = (now.tv_sec - s->ts.tv_sec) * 1000000000LL
+			+ (now.tv_nsec - s->ts.tv_nsec);
+		mask = reasonMask(s->last);
+		for (k = 0; k < REASONS; k++) {
+			if (mask & (1U << k))
+				s->ns[k] += ns;
+		}
+	}
+	// a failed sample leaves a gap instead of guessing
+	s->valid = NVML_SUCCESS == res;
+	if (s->valid)
+		s->last = reasons;
+	s->ts = now;
+	pthread_mutex_unlock(&(th.lock));
+}
+
+static void *
+throttleLoop(void *arg) {
+	struct timespec ts;
+	uint i;
+	long period = 1000000000L / th.hz;
+
+	(void) arg;
+	PROM_DEBUG("Throttle sampler started", "");
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	while (!atomic_load(&(th.stop))) {
+		for (i = 0; i < th.count; i++)
+			update(&(th.s[i]));
+		ts.tv_nsec += period;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec -= 1000000000L;
+			ts.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	PROM_DEBUG("Throttle sampler stopped", "");
+	return NULL;
+}
+
+uint
+startThrottleSampler(uint devs, gpu_t devList[]) {
+	nvmlReturn_t res;
+	unsigned long long reasons;
+	tsampler_t *s;
+	gpu_t *gpu;
+	uint i;
+
+	if (th.hz == 0 || th.s != NULL || devs == 0)
+		return th.hz == 0 ? 0 : 1;
+	th.s = calloc(devs, sizeof(tsampler_t));
+	if (th.s == NULL)
+		return 1;
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasClockThrottle == -1)
+			continue;
+		res = nvmlDeviceGetCurrentClocksThrottleReasons(gpu->dev, &reasons);
+		if (NVML_SUCCESS != res) {
+			if (NOT_AVAIL(res)) {
+				PROM_DEBUG("gpu.hasClockThrottle = -1", "");
+				gpu->hasClockThrottle = -1;
+			}
+			continue;
+		}
+		s = &(th.s[th.count]);
+		res = nvmlDeviceGetSupportedClocksThrottleReasons(gpu->dev,
+			&(s->supported));
+		if (NVML_SUCCESS != res)
+			s->supported = ~0ULL;
+		s->gpu = gpu;
+		th.count++;
+	}
+	if (th.count == 0)
+		goto fail;
+	atomic_store(&(th.stop), false);
+	if (pthread_create(&(th.thread), NULL, throttleLoop, NULL) != 0) {
+		PROM_WARN("Unable to start throttle sampler", "");
+		goto fail;
+	}
+	PROM_DEBUG("Throttle sampler for %u GPUs (%u Hz)", th.count, th.hz);
+	return 0;
+
+fail:
+	free(th.s);
+	th.s = NULL;
+	th.count = 0;
+	return 1;
+}
+
+void
+stopThrottleSampler(void) {
+	if (th.s == NULL)
+		return;
+	atomic_store(&(th.stop), true);
+	pthread_join(th.thread, NULL);
+	free(th.s);
+	th.s = NULL;
+	th.count = 0;
+}
+
+bool
+getThrottle(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	tsampler_t *s;
+	size_t sz;
+	uint i, k, supported, active;
+	char buf[MBUF_SZ];
+	bool free_sb = sb == NULL;
+	psb_t *sba;
+
+	(void) devList;
+	if (devs == 0 || th.count == 0)
+		return false;
+
+	PROM_DEBUG("getThrottle", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+	sba = psb_new();
+	if (sba == NULL)
+		goto end;
+
+	if (!compact)
+		addPromInfo(NVMEXM_THROTTLE_SEC);
+	pthread_mutex_lock(&(th.lock));
+	for (i = 0; i < th.count; i++) {
+		s = &(th.s[i]);
+		supported = reasonMask(s->supported);
+		active = s->valid ? reasonMask(s->last) : 0;
+		for (k = 0; k < REASONS; k++) {
+			if ((supported & (1U << k)) == 0)
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_THROTTLE_SEC_N
+				"{gpu=\"%d\",reason=\"%s\",uuid=\"%s\"} %.3f\n",
+				s->gpu->idx, reason[k].name, s->gpu->uuid, s->ns[k] / 1e9);
+			psb_add_str(sb, buf);
+			if (!s->valid)
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_THROTTLE_ACTIVE_N
+				"{gpu=\"%d\",reason=\"%s\",uuid=\"%s\"} %d\n",
+				s->gpu->idx, reason[k].name, s->gpu->uuid,
+				(active & (1U << k)) != 0);
+			psb_add_str(sba, buf);
+		}
+	}
+	pthread_mutex_unlock(&(th.lock));
+	if (psb_len(sba) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_THROTTLE_ACTIVE);
+		psb_add_str(sb, psb_str(sba));
+	}
+	psb_destroy(sba);
+
+end:
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
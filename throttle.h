@@ -0,0 +1,66 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file throttle.h
+ * Time spent per clock throttle reason, sampled in the background.
+ */
+
+#ifndef NVMEX_THROTTLE_H
+#define NVMEX_THROTTLE_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Set the rate of the background clock throttle reason sampler.
+ * @param hz	samples per second: \c 0 (disabled, the default) or
+ *	\c 1 .. \c 100 .
+ * @return \c 0 on success, \c 1 if the given value is invalid.
+ */
+int setThrottleSampling(const char *hz);
+
+/**
+ * Start a background thread, which reads the current clock throttle reasons
+ * of each GPU with the rate set via \c setThrottleSampling() and sums up the
+ * time each reason was active. Does nothing if sampling is disabled.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to sample. Must not be \c NULL and must
+ *	stay valid until \c stopThrottleSampler() got called!
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+uint startThrottleSampler(uint devs, gpu_t devList[]);
+
+/**
+ * Stop the clock throttle reason sampler thread and release related
+ * resources.
+ */
+void stopThrottleSampler(void);
+
+/**
+ * Get the time spent per clock throttle reason and the reasons currently
+ * active as seen by the sampler thread.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getThrottle(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_THROTTLE_H
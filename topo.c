@@ -0,0 +1,252 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topo.h"
+
+// max. number of CPUs reported per GPU
+#define MAX_CPUS 4096
+#define CPU_WORDS (MAX_CPUS / (sizeof(unsigned long) * 8))
+
+// rendered once per device enumeration
+static struct {
+	char	*path;		//!< nvmex_topology_path lines
+	char	*nvlinks;	//!< nvmex_topology_nvlinks lines
+	char	*cpus;		//!< nvmex_topology_cpu_affinity_info lines
+	char	*json;		//!< all of it as JSON document
+} topo = { NULL, NULL, NULL, NULL };
+
+void
+freeTopology(void) {
+	free(topo.path);
+	free(topo.nvlinks);
+	free(topo.cpus);
+	free(topo.json);
+	memset(&topo, 0, sizeof(topo));
+}
+
+// the names nvidia-smi uses
+static const char *
+levelName(nvmlGpuTopologyLevel_t level) {
+	switch (level) {
+		case NVML_TOPOLOGY_INTERNAL:	return "BOARD";
+		case NVML_TOPOLOGY_SINGLE:		return "PIX";
+		case NVML_TOPOLOGY_MULTIPLE:	return "PXB";
+		case NVML_TOPOLOGY_HOSTBRIDGE:	return "PHB";
+		case NVML_TOPOLOGY_NODE:		return "NODE";
+		default:						return "SYS";
+	}
+}
+
+// the CPUs of the given set as list of ranges, e.g. 0-23,48-71
+static void
+cpuList(char *buf, size_t len, unsigned long set[]) {
+	uint i, k, bits = sizeof(unsigned long) * 8;
+	size_t n = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < MAX_CPUS && n < len; i++) {
+		if ((set[i / bits] & (1UL << (i % bits))) == 0)
+			continue;
+		for (k = i; k + 1 < MAX_CPUS
+			&& (set[(k + 1) / bits] & (1UL << ((k + 1) % bits))) != 0; k++)
+			;
+		if (k == i)
+			n += snprintf(buf + n, len - n, "%s%u", n ? "," : "", i);
+		else
+			n += snprintf(buf + n, len - n, "%s%u-%u", n ? "," : "", i, k);
+		i = k;
+	}
+	if (n >= len)
+		buf[len - 1] = '\0';
+}
+
+/*
+ * Count the active NVLinks of gpu per peer GPU. links[devs] gets the number
+ * of links to something else than a GPU, e.g. a NVSwitch. Records the peer
+ * of each link in gpu->nvLinkPeer as well.
+ */
+static void
+countLinks(gpu_t *gpu, uint devs, gpu_t devList[], uint links[]) {
+	nvmlReturn_t res;
+	nvmlEnableState_t state;
+	nvmlPciInfo_t pci;
+	char buf[32];
+	uint k, j;
+
+	for (k = 0; k < NVML_NVLINK_MAX_LINKS; k++) {
+		gpu->nvLinkPeer[k] = NVLINK_PEER_UNKNOWN;
+		res = nvmlDeviceGetNvLinkState(gpu->dev, k, &state);
+		if (NVML_SUCCESS != res || state != NVML_FEATURE_ENABLED)
+			continue;
+		if (nvmlDeviceGetNvLinkRemotePciInfo_v2(gpu->dev, k, &pci)
+			!= NVML_SUCCESS)
+		{
+			continue;
+		}
+		snprintf(buf, sizeof(buf), "%04x:%02x:%02x.0",
+			pci.domain, pci.bus, pci.device);
+		for (j = 0; j < devs; j++) {
+			if (devList[j].pciId != NULL && strcmp(devList[j].pciId, buf) == 0)
+				break;
+		}
+		links[j]++;
+		gpu->nvLinkPeer[k] = j < devs
+			? (short) devList[j].idx : NVLINK_PEER_OTHER;
+	}
+}
+
+void
+initTopology(uint devs, gpu_t devList[]) {
+	nvmlGpuTopologyLevel_t level;
+	gpu_t *gpu, *peer;
+	uint i, j, *links;
+	unsigned long set[CPU_WORDS];
+	char buf[MBUF_SZ * 2], cpus[MBUF_SZ];
+	psb_t *sbp, *sbn, *sbc, *sbj;
+	bool first, firstGpu = true;
+
+	freeTopology();
+	if (devs == 0)
+		return;
+	links = calloc(devs + 1, sizeof(uint));
+	sbp = psb_new();
+	sbn = psb_new();
+	sbc = psb_new();
+	sbj = psb_new();
+	if (links == NULL || sbp == NULL || sbn == NULL || sbc == NULL
+		|| sbj == NULL)
+	{
+		goto end;
+	}
+
+	psb_add_str(sbj, "{\"gpus\":[");
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL)
+			continue;
+		memset(links, 0, sizeof(uint) * (devs + 1));
+		countLinks(gpu, devs, devList, links);
+		if (nvmlDeviceGetCpuAffinity(gpu->dev, CPU_WORDS, set) == NVML_SUCCESS)
+			cpuList(cpus, sizeof(cpus), set);
+		else
+			cpus[0] = '\0';
+
+		snprintf(buf, sizeof(buf), "%s\n{\"gpu\":%u,\"uuid\":\"GPU-%s\","
+			"\"pci\":\"%s\",\"cpus\":\"%s\",\"nvlinks_other\":%u,\"peers\":[",
+			firstGpu ? "" : ",", gpu->idx, gpu->uuid,
+			gpu->pciId == NULL ? "" : gpu->pciId, cpus, links[devs]);
+		psb_add_str(sbj, buf);
+		firstGpu = false;
+		if (cpus[0] != '\0') {
+			snprintf(buf, sizeof(buf), NVMEXM_TOPO_CPU_N
+				"{gpu=\"%u\",cpus=\"%s\",uuid=\"%s\"} 1\n",
+				gpu->idx, cpus, gpu->uuid);
+			psb_add_str(sbc, buf);
+		}
+		if (links[devs] > 0) {
+			snprintf(buf, sizeof(buf), NVMEXM_TOPO_NVLINK_N
+				"{gpu=\"%u\",peer=\"other\",uuid=\"%s\"} %u\n",
+				gpu->idx, gpu->uuid, links[devs]);
+			psb_add_str(sbn, buf);
+		}
+
+		first = true;
+		for (j = 0; j < devs; j++) {
+			peer = &(devList[j]);
+			if (j == i || peer->dev == NULL)
+				continue;
+			if (nvmlDeviceGetTopologyCommonAncestor(gpu->dev, peer->dev, &level)
+				!= NVML_SUCCESS)
+			{
+				continue;
+			}
+			snprintf(buf, sizeof(buf), "%s{\"gpu\":%u,\"path\":\"%s\","
+				"\"level\":%u,\"nvlinks\":%u}", first ? "" : ",",
+				peer->idx, levelName(level), level, links[j]);
+			psb_add_str(sbj, buf);
+			first = false;
+			snprintf(buf, sizeof(buf), NVMEXM_TOPO_PATH_N
+				"{gpu=\"%u\",peer=\"%u\",path=\"%s\",uuid=\"%s\"} %u\n",
+				gpu->idx, peer->idx, levelName(level), gpu->uuid, level);
+			psb_add_str(sbp, buf);
+			if (links[j] == 0)
+				continue;
+			snprintf(buf, sizeof(buf), NVMEXM_TOPO_NVLINK_N
+				"{gpu=\"%u\",peer=\"%u\",uuid=\"%s\"} %u\n",
+				gpu->idx, peer->idx, gpu->uuid, links[j]);
+			psb_add_str(sbn, buf);
+		}
+		psb_add_str(sbj, "]}");
+	}
+	psb_add_str(sbj, "\n]}\n");
+
+	topo.path = psb_dump(sbp);
+	topo.nvlinks = psb_dump(sbn);
+	topo.cpus = psb_dump(sbc);
+	topo.json = psb_dump(sbj);
+	PROM_DEBUG("Topology: %s", topo.json);
+
+end:
+	free(links);
+	psb_destroy(sbp);
+	psb_destroy(sbn);
+	psb_destroy(sbc);
+	psb_destroy(sbj);
+}
+
+char *
+getTopologyJSON(void) {
+	return topo.json;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+bool
+getTopology(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	size_t sz;
+	bool free_sb = sb == NULL;
+
+	if (topo.json == NULL)
+		return false;
+
+	PROM_DEBUG("getTopology", "");
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	if (topo.path[0] != '\0') {
+		if (!compact)
+			addPromInfo(NVMEXM_TOPO_PATH);
+		psb_add_str(sb, topo.path);
+	}
+	if (topo.nvlinks[0] != '\0') {
+		if (!compact)
+			addPromInfo(NVMEXM_TOPO_NVLINK);
+		psb_add_str(sb, topo.nvlinks);
+	}
+	if (topo.cpus[0] != '\0') {
+		if (!compact)
+			addPromInfo(NVMEXM_TOPO_CPU);
+		psb_add_str(sb, topo.cpus);
+	}
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
+#pragma GCC diagnostic pop
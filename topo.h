@@ -0,0 +1,60 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file topo.h
+ * GPU to GPU and GPU to CPU topology.
+ */
+
+#ifndef NVMEX_TOPO_H
+#define NVMEX_TOPO_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Determine the PCIe path and the number of NVLinks between all GPUs and the
+ * CPU affinity of each GPU, and render the result as prom metrics and JSON
+ * document. Should be called whenever the devices get enumerated.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to inspect.
+ */
+void initTopology(uint devs, gpu_t devList[]);
+
+/**
+ * Free the topology rendered by \c initTopology().
+ */
+void freeTopology(void);
+
+/**
+ * Get the topology metrics rendered by \c initTopology().
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getTopology(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+/**
+ * Get the topology rendered by \c initTopology() as JSON document.
+ * @return \c NULL if not available, the document otherwise. Must not be freed!
+ */
+char *getTopologyJSON(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_TOPO_H
@@ -9,8 +9,126 @@
  * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "util.h"
 
+// sample types: utilization first, clocks last
+static const struct {
+	nvmlSamplingType_t	type;
+	const char	*name;
+} stype[] = {
+	{ NVML_GPU_UTILIZATION_SAMPLES, "gpu" },
+	{ NVML_MEMORY_UTILIZATION_SAMPLES, "memory" },
+	{ NVML_ENC_UTILIZATION_SAMPLES, "encoder" },
+	{ NVML_DEC_UTILIZATION_SAMPLES, "decoder" },
+	{ NVML_PROCESSOR_CLK_SAMPLES, "GRAPHICS" },
+	{ NVML_MEMORY_CLK_SAMPLES, "MEM" },
+};
+#define STYPES (sizeof(stype)/sizeof(stype[0]))
+#define UTYPES 4
+
+// upper bounds of the histogram buckets in percent (+Inf is implicit)
+static const uint bucket[] = { 0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100 };
+#define BUCKETS (sizeof(bucket)/sizeof(uint))
+
+static const char *vname[] = { "min", "max", "mean" };
+
+typedef struct usamples_st {
+	unsigned long long	last[STYPES];	//!< timestamp (us) of the last sample
+	char	has[STYPES];
+	unsigned long long	count[UTYPES][BUCKETS + 1];	//!< samples per bucket
+	unsigned long long	sum[UTYPES];
+	unsigned long long	zeroUs[UTYPES];	//!< time at 0 % in us
+} usamples_t;
+
+unsigned long long
+sampleValue(nvmlValueType_t vt, nvmlValue_t *v) {
+	switch (vt) {
+		case NVML_VALUE_TYPE_DOUBLE:
+			return v->dVal;
+		case NVML_VALUE_TYPE_UNSIGNED_LONG:
+			return v->ulVal;
+		case NVML_VALUE_TYPE_UNSIGNED_LONG_LONG:
+			return v->ullVal;
+		case NVML_VALUE_TYPE_SIGNED_LONG_LONG:
+			return v->sllVal < 0 ? 0 : v->sllVal;
+		case NVML_VALUE_TYPE_SIGNED_INT:
+			return v->siVal < 0 ? 0 : v->siVal;
+		default:
+			return v->uiVal;
+	}
+}
+
+void
+freeSamples(gpu_t *gpu) {
+	free(gpu->usamples);
+	gpu->usamples = NULL;
+}
+
+/*
+ * Consume all samples of the given type taken since the last call. Update
+ * the histogram of utilization types, the window summary in min/max/sum of
+ * clock types. Returns the number of samples consumed, i.e. not including
+ * samples already seen by the previous call.
+ */
+static uint
+consume(gpu_t *gpu, uint k, unsigned long long *min, unsigned long long *max,
+	unsigned long long *sum)
+{
+	nvmlReturn_t res;
+	nvmlValueType_t vt;
+	nvmlSample_t *samples;
+	usamples_t *us = gpu->usamples;
+	unsigned long long v, ts;
+	uint i, b, n = 0, used = 0;
+
+	res = nvmlDeviceGetSamples(gpu->dev, stype[k].type, us->last[k], &vt, &n,
+		NULL);
+	if (NVML_SUCCESS != res || n == 0) {
+		if (NOT_AVAIL(res)) {
+			PROM_DEBUG("gpu[%u].%s samples = -1", gpu->idx, stype[k].name);
+			us->has[k] = -1;
+		}
+		return 0;
+	}
+	samples = malloc(sizeof(nvmlSample_t) * n);
+	if (samples == NULL)
+		return 0;
+	res = nvmlDeviceGetSamples(gpu->dev, stype[k].type, us->last[k], &vt, &n,
+		samples);
+	if (NVML_SUCCESS != res)
+		n = 0;
+	*min = ~0ULL;
+	*max = *sum = 0;
+	for (i = 0; i < n; i++) {
+		ts = samples[i].timeStamp;
+		if (ts <= us->last[k])
+			continue;
+		v = sampleValue(vt, &(samples[i].sampleValue));
+		if (v < *min)
+			*min = v;
+		if (v > *max)
+			*max = v;
+		*sum += v;
+		used++;
+		if (k < UTYPES) {
+			for (b = 0; b < BUCKETS && v > bucket[b]; b++)
+				;
+			us->count[k][b]++;
+			us->sum[k] += v;
+			// a sample covers the time since the previous one
+			if (v == 0 && us->last[k] != 0)
+				us->zeroUs[k] += ts - us->last[k];
+		}
+		us->last[k] = ts;
+	}
+	free(samples);
+	us->has[k] = 1;
+	return used;
+}
+
 bool
 getUtilization(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	nvmlReturn_t res;
@@ -41,8 +159,8 @@ getUtilization(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 				snprintf(buf, sizeof(buf),
 				NVMEXM_UTIL_N "{gpu=\"%d\",dev=\"gpu\",uuid=\"%s\"} %u\n"
 				NVMEXM_UTIL_N "{gpu=\"%d\",dev=\"memory\",uuid=\"%s\"} %u\n",
-					i, gpu->uuid, percent.gpu,
-					i, gpu->uuid, percent.memory);
+					gpu->idx, gpu->uuid, percent.gpu,
+					gpu->idx, gpu->uuid, percent.memory);
 				psb_add_str(sb, buf);
 				gpu->hasUtil = 1;
 			} else if (NOT_AVAIL(res)) {
@@ -58,7 +176,7 @@ getUtilization(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 					"#  sample interval: %u ms\n", period);
 				snprintf(buf + len, sizeof(buf) - len,
 				NVMEXM_UTIL_N "{gpu=\"%d\",dev=\"decoder\",uuid=\"%s\"} %u\n",
-					i, gpu->uuid, percent);
+					gpu->idx, gpu->uuid, percent);
 				psb_add_str(sb, buf);
 				gpu->hasDecoderUtil = 1;
 			} else if (NOT_AVAIL(res)) {
@@ -71,7 +189,7 @@ getUtilization(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 					"#  sample interval: %u ms\n", period);
 				snprintf(buf + len, sizeof(buf) - len,
 				NVMEXM_UTIL_N "{gpu=\"%d\",dev=\"encoder\",uuid=\"%s\"} %u\n",
-					i, gpu->uuid, percent);
+					gpu->idx, gpu->uuid, percent);
 				psb_add_str(sb, buf);
 			} else if (NOT_AVAIL(res)) {
 				PROM_DEBUG("gpu.hasEncoderUtil = -1", "");
@@ -86,3 +204,106 @@ getUtilization(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	}
 	return sz != 0;
 }
+
+bool
+getSamples(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	gpu_t *gpu;
+	usamples_t *us;
+	size_t sz;
+	uint i, k, b, n;
+	unsigned long long min, max, sum, cnt, vals[3];
+	char buf[MBUF_SZ];
+	bool free_sb = sb == NULL;
+	psb_t *sbz, *sbc;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getSamples", "");
+	sbz = psb_new();
+	sbc = psb_new();
+	if (sbz == NULL || sbc == NULL) {
+		psb_destroy(sbz);
+		psb_destroy(sbc);
+		return false;
+	}
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_UTIL_HIST);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL)
+			continue;
+		if (gpu->usamples == NULL) {
+			gpu->usamples = calloc(1, sizeof(usamples_t));
+			if (gpu->usamples == NULL)
+				continue;
+		}
+		us = gpu->usamples;
+		for (k = 0; k < STYPES; k++) {
+			if (us->has[k] == -1)
+				continue;
+			n = consume(gpu, k, &min, &max, &sum);
+			if (us->has[k] != 1)
+				continue;
+			if (k >= UTYPES) {
+				if (n == 0 || max == 0)
+					continue;
+				vals[0] = min;
+				vals[1] = max;
+				vals[2] = sum / n;
+				for (b = 0; b < 3; b++) {
+					snprintf(buf, sizeof(buf), NVMEXM_CLOCK_WINDOW_N
+						"{gpu=\"%d\",domain=\"%s\",value=\"%s\",uuid=\"%s\"} %llu\n",
+						gpu->idx, stype[k].name, vname[b], gpu->uuid, vals[b]);
+					psb_add_str(sbc, buf);
+				}
+				continue;
+			}
+			cnt = 0;
+			for (b = 0; b <= BUCKETS; b++) {
+				cnt += us->count[k][b];
+				if (b < BUCKETS) {
+					snprintf(buf, sizeof(buf), NVMEXM_UTIL_HIST_N "_bucket"
+						"{gpu=\"%d\",dev=\"%s\",le=\"%u\",uuid=\"%s\"} %llu\n",
+						gpu->idx, stype[k].name, bucket[b], gpu->uuid, cnt);
+				} else {
+					snprintf(buf, sizeof(buf), NVMEXM_UTIL_HIST_N "_bucket"
+						"{gpu=\"%d\",dev=\"%s\",le=\"+Inf\",uuid=\"%s\"} %llu\n",
+						gpu->idx, stype[k].name, gpu->uuid, cnt);
+				}
+				psb_add_str(sb, buf);
+			}
+			snprintf(buf, sizeof(buf), NVMEXM_UTIL_HIST_N
+				"_sum{gpu=\"%d\",dev=\"%s\",uuid=\"%s\"} %llu\n",
+				gpu->idx, stype[k].name, gpu->uuid, us->sum[k]);
+			psb_add_str(sb, buf);
+			snprintf(buf, sizeof(buf), NVMEXM_UTIL_HIST_N
+				"_count{gpu=\"%d\",dev=\"%s\",uuid=\"%s\"} %llu\n",
+				gpu->idx, stype[k].name, gpu->uuid, cnt);
+			psb_add_str(sb, buf);
+			snprintf(buf, sizeof(buf), NVMEXM_UTIL_ZERO_N
+				"{gpu=\"%d\",dev=\"%s\",uuid=\"%s\"} %.6f\n",
+				gpu->idx, stype[k].name, gpu->uuid, us->zeroUs[k] / 1e6);
+			psb_add_str(sbz, buf);
+		}
+	}
+	if (!compact)
+		addPromInfo(NVMEXM_UTIL_ZERO);
+	psb_add_str(sb, psb_str(sbz));
+	if (!compact)
+		addPromInfo(NVMEXM_CLOCK_WINDOW);
+	psb_add_str(sb, psb_str(sbc));
+	psb_destroy(sbz);
+	psb_destroy(sbc);
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
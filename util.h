@@ -34,6 +34,33 @@ extern "C" {
  */
 bool getUtilization(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
 
+/**
+ * Get utilization histograms and clock summaries from all samples the driver
+ * took since the previous call. The per GPU timestamp of the last sample
+ * seen is global, i.e. not kept per requester, which matters for the clock
+ * window summaries only.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getSamples(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+/**
+ * Convert a sample value to an unsigned number. Negative values become 0.
+ * @param vt	the type of the value.
+ * @param v	the value to convert.
+ * @return the converted value.
+ */
+unsigned long long sampleValue(nvmlValueType_t vt, nvmlValue_t *v);
+
+/**
+ * Free the sample state of the given GPU.
+ * @param gpu	the GPU whose state should be freed.
+ */
+void freeSamples(gpu_t *gpu);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,312 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vgpu.h"
+#include "util.h"
+
+enum { ENG_SM, ENG_MEM, ENG_ENC, ENG_DEC, ENGINES };
+
+static const char *engine[] = { "sm", "memory", "encoder", "decoder" };
+
+// a vGPU instance, static attributes get read once
+typedef struct vgpu_st {
+	nvmlVgpuInstance_t	id;
+	char	*info;			//!< rendered info metric
+	unsigned long long	fbTotal;	//!< framebuffer size of the vGPU type
+	uint	gen;			//!< last scrape the instance was active
+	uint	n;				//!< number of utilization samples
+	unsigned long long	util[ENGINES];	//!< sum of utilization samples
+	bool	hasAvg;			//!< avg is set
+	unsigned long long	avg[ENGINES];	//!< last mean utilization reported
+} vgpu_t;
+
+typedef struct vgpus_st {
+	vgpu_t	*v;
+	uint	count;
+	uint	max;
+	nvmlVgpuInstance_t	*ids;	//!< buffer for the active instance IDs
+	uint	maxids;
+	nvmlVgpuInstanceUtilizationSample_t	*samples;
+	uint	maxsamples;
+	unsigned long long	last;	//!< timestamp of the last utilization sample
+	uint	gen;
+} vgpus_t;
+
+void
+freeVgpu(gpu_t *gpu) {
+	uint i;
+
+	if (gpu->vgpus == NULL)
+		return;
+	for (i = 0; i < gpu->vgpus->count; i++)
+		free(gpu->vgpus->v[i].info);
+	free(gpu->vgpus->v);
+	free(gpu->vgpus->ids);
+	free(gpu->vgpus->samples);
+	free(gpu->vgpus);
+	gpu->vgpus = NULL;
+}
+
+static bool
+grow(void **a, uint *max, uint min, size_t sz) {
+	void *p;
+	uint n = min + 8;
+
+	if (*max >= min)
+		return true;
+	p = realloc(*a, n * sz);
+	if (p == NULL)
+		return false;
+	*a = p;
+	*max = n;
+	return true;
+}
+
+// label values provided by VMs are not trustworthy
+static void
+sanitize(char *s) {
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\' || *s == '\n')
+			*s = '_';
+	}
+}
+
+static void
+setStatic(gpu_t *gpu, vgpu_t *v) {
+	nvmlVgpuTypeId_t type;
+	nvmlVgpuVmIdType_t vmIdType;
+	char uuid[80], vm[80], name[NVML_VGPU_NAME_BUFFER_SIZE], buf[MBUF_SZ * 2];
+	uint len = sizeof(name);
+
+	uuid[0] = vm[0] = name[0] = '\0';
+	nvmlVgpuInstanceGetUUID(v->id, uuid, sizeof(uuid));
+	nvmlVgpuInstanceGetVmID(v->id, vm, sizeof(vm), &vmIdType);
+	if (nvmlVgpuInstanceGetType(v->id, &type) == NVML_SUCCESS) {
+		nvmlVgpuTypeGetName(type, name, &len);
+		if (nvmlVgpuTypeGetFramebufferSize(type, &(v->fbTotal))
+			!= NVML_SUCCESS)
+		{
+			v->fbTotal = 0;
+		}
+	}
+	sanitize(uuid);
+	sanitize(vm);
+	sanitize(name);
+	snprintf(buf, sizeof(buf), NVMEXM_VGPU_INFO_N "{gpu=\"%d\",vgpu=\"%u\","
+		"vgpu_uuid=\"%s\",vm=\"%s\",type=\"%s\",uuid=\"%s\"} 1\n",
+		gpu->idx, v->id, uuid, vm, name, gpu->uuid);
+	v->info = strdup(buf);
+}
+
+static vgpu_t *
+lookup(gpu_t *gpu, nvmlVgpuInstance_t id) {
+	vgpus_t *vs = gpu->vgpus;
+	vgpu_t *v;
+	uint i;
+
+	for (i = 0; i < vs->count; i++) {
+		if (vs->v[i].id == id)
+			return &(vs->v[i]);
+	}
+	if (!grow((void **) &(vs->v), &(vs->max), vs->count + 1, sizeof(vgpu_t)))
+		return NULL;
+	v = &(vs->v[vs->count++]);
+	memset(v, 0, sizeof(vgpu_t));
+	v->id = id;
+	setStatic(gpu, v);
+	PROM_DEBUG("GPU %u: new vGPU instance %u", gpu->idx, id);
+	return v;
+}
+
+// update the list of active instances, drop inactive ones
+static bool
+updateInstances(gpu_t *gpu) {
+	nvmlReturn_t res;
+	vgpus_t *vs = gpu->vgpus;
+	vgpu_t *v;
+	uint i, n;
+
+	for (;;) {
+		n = vs->maxids;
+		res = nvmlDeviceGetActiveVgpus(gpu->dev, &n, vs->ids);
+		if (res != NVML_ERROR_INSUFFICIENT_SIZE)
+			break;
+		if (!grow((void **) &(vs->ids), &(vs->maxids), n,
+			sizeof(nvmlVgpuInstance_t)))
+		{
+			return false;
+		}
+	}
+	if (NOT_AVAIL(res)) {
+		PROM_DEBUG("gpu.hasVgpu = -1", "");
+		gpu->hasVgpu = -1;
+		return false;
+	}
+	if (NVML_SUCCESS != res)
+		return false;
+	gpu->hasVgpu = 1;
+	vs->gen++;
+	for (i = 0; i < n; i++) {
+		v = lookup(gpu, vs->ids[i]);
+		if (v == NULL)
+			continue;
+		v->gen = vs->gen;
+		v->n = 0;
+		memset(v->util, 0, sizeof(v->util));
+	}
+	for (i = 0; i < vs->count; ) {
+		if (vs->v[i].gen != vs->gen) {
+			free(vs->v[i].info);
+			vs->v[i] = vs->v[--vs->count];
+		} else {
+			i++;
+		}
+	}
+	return vs->count > 0;
+}
+
+// one call for all instances: fetch the samples since the last call
+static void
+updateUtil(gpu_t *gpu) {
+	nvmlReturn_t res;
+	nvmlValueType_t vt;
+	nvmlVgpuInstanceUtilizationSample_t *s;
+	vgpus_t *vs = gpu->vgpus;
+	unsigned long long last = vs->last;
+	uint i, k, n = 0;
+
+	res = nvmlDeviceGetVgpuUtilization(gpu->dev, last, &vt, &n, NULL);
+	// NVML_ERROR_NOT_FOUND: no samples since last
+	if ((NVML_SUCCESS != res && NVML_ERROR_INSUFFICIENT_SIZE != res) || n == 0)
+		return;
+	n += vs->count;
+	if (!grow((void **) &(vs->samples), &(vs->maxsamples), n,
+		sizeof(nvmlVgpuInstanceUtilizationSample_t)))
+	{
+		return;
+	}
+	res = nvmlDeviceGetVgpuUtilization(gpu->dev, last, &vt, &n, vs->samples);
+	if (NVML_SUCCESS != res)
+		return;
+	for (i = 0; i < n; i++) {
+		s = &(vs->samples[i]);
+		if (s->timeStamp <= last)
+			continue;
+		if (s->timeStamp > vs->last)
+			vs->last = s->timeStamp;
+		for (k = 0; k < vs->count && vs->v[k].id != s->vgpuInstance; k++)
+			;
+		if (k == vs->count)
+			continue;
+		vs->v[k].n++;
+		vs->v[k].util[ENG_SM] += sampleValue(vt, &(s->smUtil));
+		vs->v[k].util[ENG_MEM] += sampleValue(vt, &(s->memUtil));
+		vs->v[k].util[ENG_ENC] += sampleValue(vt, &(s->encUtil));
+		vs->v[k].util[ENG_DEC] += sampleValue(vt, &(s->decUtil));
+	}
+}
+
+bool
+getVgpu(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
+	nvmlReturn_t res;
+	gpu_t *gpu;
+	vgpu_t *v;
+	size_t sz;
+	uint i, k, e;
+	unsigned long long fb;
+	char buf[MBUF_SZ];
+	bool free_sb = sb == NULL;
+	psb_t *sbf, *sbu;
+
+	if (devs == 0)
+		return false;
+
+	PROM_DEBUG("getVgpu", "");
+	sbf = psb_new();
+	sbu = psb_new();
+	if (sbf == NULL || sbu == NULL) {
+		psb_destroy(sbf);
+		psb_destroy(sbu);
+		return false;
+	}
+	if (free_sb)
+		sb = psb_new();
+	sz = psb_len(sb);
+
+	if (!compact)
+		addPromInfo(NVMEXM_VGPU_INFO);
+	for (i = 0; i < devs; i++) {
+		gpu = &(devList[i]);
+		if (gpu->dev == NULL || gpu->hasVgpu == -1)
+			continue;
+		if (gpu->vgpus == NULL) {
+			gpu->vgpus = calloc(1, sizeof(vgpus_t));
+			if (gpu->vgpus == NULL)
+				continue;
+		}
+		if (!updateInstances(gpu))
+			continue;
+		updateUtil(gpu);
+		for (k = 0; k < gpu->vgpus->count; k++) {
+			v = &(gpu->vgpus->v[k]);
+			if (v->info != NULL)
+				psb_add_str(sb, v->info);
+
+			res = nvmlVgpuInstanceGetFbUsage(v->id, &fb);
+			if (NVML_SUCCESS == res) {
+				snprintf(buf, sizeof(buf), NVMEXM_VGPU_FB_N "{gpu=\"%d\","
+					"vgpu=\"%u\",value=\"used\",uuid=\"%s\"} %llu\n",
+					gpu->idx, v->id, gpu->uuid, fb);
+				psb_add_str(sbf, buf);
+			}
+			if (v->fbTotal > 0) {
+				snprintf(buf, sizeof(buf), NVMEXM_VGPU_FB_N "{gpu=\"%d\","
+					"vgpu=\"%u\",value=\"total\",uuid=\"%s\"} %llu\n",
+					gpu->idx, v->id, gpu->uuid, v->fbTotal);
+				psb_add_str(sbf, buf);
+			}
+
+			// no new samples: keep reporting the last mean
+			if (v->n > 0) {
+				for (e = 0; e < ENGINES; e++)
+					v->avg[e] = v->util[e] / v->n;
+				v->hasAvg = true;
+			}
+			if (!v->hasAvg)
+				continue;
+			for (e = 0; e < ENGINES; e++) {
+				snprintf(buf, sizeof(buf), NVMEXM_VGPU_UTIL_N "{gpu=\"%d\","
+					"vgpu=\"%u\",engine=\"%s\",uuid=\"%s\"} %llu\n",
+					gpu->idx, v->id, engine[e], gpu->uuid, v->avg[e]);
+				psb_add_str(sbu, buf);
+			}
+		}
+	}
+	if (!compact)
+		addPromInfo(NVMEXM_VGPU_FB);
+	psb_add_str(sb, psb_str(sbf));
+	if (!compact)
+		addPromInfo(NVMEXM_VGPU_UTIL);
+	psb_add_str(sb, psb_str(sbu));
+	psb_destroy(sbf);
+	psb_destroy(sbu);
+
+	sz = psb_len(sb) - sz;
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+	return sz != 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2021 Jens Elkner (jel+nvmex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file vgpu.h
+ * Metrics of vGPU instances as seen by the virtualization host.
+ */
+
+#ifndef NVMEX_VGPU_H
+#define NVMEX_VGPU_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Get vGPU instance related metrics. The utilization is the mean of the
+ * samples since the previous call, whichever requester made it.
+ * @param sb	where to append the metrics.
+ * @param compact	If \c true do not add prom descriptions and type comments.
+ * @param devs	number of devices in \c devList.
+ * @param devList	list of devices to query. Must not be \c NULL !
+ * @return \c true if something got append to \c sb , \c false otherwise.
+ */
+bool getVgpu(psb_t *sb, bool compact, uint devs, gpu_t devList[]);
+
+/**
+ * Free the vGPU instance cache of the given GPU.
+ * @param gpu	the GPU whose cache should be freed.
+ */
+void freeVgpu(gpu_t *gpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// NVMEX_VGPU_H
@@ -12,6 +12,7 @@
 #include <assert.h>
 
 #include "violations.h"
+#include "rate.h"
 
 static const char *pname[] = {
 	"POWER", "THERMAL", "SYNC_BOOST", "BOARD_LIMIT", "LOW_UTIL", "RELIABILITY",
@@ -27,6 +28,8 @@ getViolations(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	int has;
 	char buf[MBUF_SZ];
 	bool free_sb = sb == NULL;
+	double rate;
+	psb_t *sbr;
 
 	if (devs == 0)
 		return false;
@@ -40,6 +43,7 @@ getViolations(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 	if (!compact)
 		addPromInfo(NVMEXM_VIOL);
 
+	sbr = psb_new();
 	for (i = 0; i < devs; i++) {
 		nvmlPerfPolicyType_t policy;
 		nvmlViolationTime_t time;
@@ -61,17 +65,33 @@ getViolations(psb_t *sb, bool compact, uint devs, gpu_t devList[]) {
 				// we do not care about < 5 ms deltas wrt. reference time
 				snprintf(buf, sizeof(buf),
 					NVMEXM_VIOL_N "{gpu=\"%d\",policy=\"%s\",uuid=\"%s\"} %g\n",
-					i, pname[policy], gpu->uuid, time.violationTime * 1e-6);
+					gpu->idx, pname[policy], gpu->uuid,
+					time.violationTime * 1e-6);
 				psb_add_str(sb, buf);
 				PROM_DEBUG("%s = ref = %llu   viol = %llu", pname[policy],
 					time.referenceTime, time.violationTime);
 				has |= 1 << policy;
+				// violationTime is in ns
+				if (sbr != NULL && rtUpdate(gpu, RT_VIOL + policy,
+					time.violationTime, &rate))
+				{
+					snprintf(buf, sizeof(buf), NVMEXM_VIOL_RATE_N
+						"{gpu=\"%d\",policy=\"%s\",uuid=\"%s\"} %.4f\n",
+						gpu->idx, pname[policy], gpu->uuid, rate * 1e-9);
+					psb_add_str(sbr, buf);
+				}
 			} else if (NOT_AVAIL(res)) {
 				PROM_DEBUG("gpu.hasViolation[%s] = -1", pname[policy]);
 			}
 		}
 		gpu->hasViolation = (has == 0) ? -1 : has;
 	}
+	if (sbr != NULL && psb_len(sbr) > 0) {
+		if (!compact)
+			addPromInfo(NVMEXM_VIOL_RATE);
+		psb_add_str(sb, psb_str(sbr));
+	}
+	psb_destroy(sbr);
 
 	sz = psb_len(sb) - sz;
 	if (free_sb) {